@@ -0,0 +1,212 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "caio/caio.h"
+#include "caio/acceptor.h"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_acceptor
+#include "caio/generic.c"
+
+
+void
+caio_acceptor_init(struct caio_acceptor *a) {
+    memset(a, 0, sizeof(struct caio_acceptor));
+    a->fd = -1;
+    a->sleep = -1;
+}
+
+
+static void
+_drop(struct caio_acceptor *a, struct caio_acceptor_pending *p) {
+    close(p->fd);
+    if (a->release) {
+        a->release(a, p->conn);
+    }
+    a->dropped++;
+}
+
+
+/* Accepts up to a->batch connections, returns the number of accepted
+ * connections or -1 on fatal error. *drained is set when the backlog is
+ * empty, *exhausted when there are no descriptors or memory left for the
+ * next one. */
+static int
+_accept_batch(struct caio_acceptor *a, bool *drained, bool *exhausted) {
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    struct caio_acceptor_pending *p;
+    unsigned int count = 0;
+    int fd;
+
+    *drained = false;
+    *exhausted = false;
+    while (count < a->batch) {
+        addrlen = sizeof(addr);
+        fd = accept4(a->fd, (struct sockaddr *)&addr, &addrlen,
+                a->flags | SOCK_NONBLOCK);
+        if (fd == -1) {
+            if (CAIO_MUSTWAIT(errno)) {
+                *drained = true;
+                break;
+            }
+
+            /* The peer is gone already, not our problem */
+            if ((errno == ECONNABORTED) || (errno == EINTR) ||
+                    (errno == EPROTO)) {
+                continue;
+            }
+
+            /* Transient, the connection waits in the backlog */
+            if ((errno == EMFILE) || (errno == ENFILE) ||
+                    (errno == ENOBUFS) || (errno == ENOMEM)) {
+                a->exhausted++;
+                *exhausted = true;
+                break;
+            }
+
+            /* Spawn whatever is already accepted before failing */
+            if (count) {
+                break;
+            }
+            return -1;
+        }
+
+        p = &a->pending[count];
+        p->fd = fd;
+        p->conn = a->alloc(a, fd, (struct sockaddr *)&addr, addrlen);
+        if (p->conn == NULL) {
+            close(fd);
+            a->dropped++;
+            continue;
+        }
+
+        count++;
+    }
+
+    return count;
+}
+
+
+/* Spawns the whole batch, returns -1 if the policy says stop */
+static int
+_spawn_batch(struct caio *c, struct caio_acceptor *a, unsigned int count) {
+    struct caio_acceptor_pending *p;
+    unsigned int i;
+
+    for (i = 0; i < count; i++) {
+        p = &a->pending[i];
+        if (a->spawn(c, p->conn) == 0) {
+            a->accepted++;
+            continue;
+        }
+
+        _drop(a, p);
+        if (a->policy == CAIO_ACCEPTOR_STOP) {
+            for (i++; i < count; i++) {
+                _drop(a, &a->pending[i]);
+            }
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+ASYNC
+caio_acceptorA(struct caio_task *self, struct caio_acceptor *a) {
+    int count;
+    bool drained;
+    bool exhausted;
+    CAIO_BEGIN(self);
+
+    if ((a->alloc == NULL) || (a->spawn == NULL)) {
+        CAIO_THROW(self, EINVAL);
+    }
+
+    if (a->batch == 0) {
+        a->batch = CAIO_ACCEPTOR_BATCH_DEFAULT;
+    }
+
+    if (a->backoff == 0) {
+        a->backoff = CAIO_ACCEPTOR_BACKOFF_DEFAULT;
+    }
+
+    /* Created upfront, there may be no descriptor left when it is needed */
+    if (caio_sleep_create(&a->sleep)) {
+        CAIO_THROW(self, errno);
+    }
+
+    a->pending = malloc(sizeof(struct caio_acceptor_pending) * a->batch);
+    if (a->pending == NULL) {
+        CAIO_THROW(self, ENOMEM);
+    }
+
+    while (true) {
+        count = _accept_batch(a, &drained, &exhausted);
+        if (count == -1) {
+            CAIO_THROW(self, errno);
+        }
+
+        if (count) {
+            a->batches++;
+            if (count > a->maxbatch) {
+                a->maxbatch = count;
+            }
+
+            if (_spawn_batch(self->caio, a, count)) {
+                CAIO_THROW(self, ENOSPC);
+            }
+        }
+
+        if (exhausted) {
+            CAIO_SLEEP(self, &a->sleep, a->fdmon, a->backoff);
+            if (CAIO_HASERROR(self)) {
+                /* Retrying right away would spin */
+                CAIO_RETHROW(self);
+            }
+        }
+        else if (drained) {
+            CAIO_FILE_AWAIT(a->fdmon, self, a->fd, CAIO_IN);
+        }
+        else {
+            /* Cap reached, let the new connections run first */
+            CAIO_PASS(self, CAIO_RUNNING);
+        }
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(a->fdmon, a->fd);
+    if (a->sleep != -1) {
+        CAIO_FILE_FORGET(a->fdmon, a->sleep);
+        caio_sleep_destroy(&a->sleep);
+        a->sleep = -1;
+    }
+    free(a->pending);
+    a->pending = NULL;
+}
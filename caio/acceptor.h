@@ -0,0 +1,139 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_ACCEPTOR_H_
+#define CAIO_ACCEPTOR_H_
+
+
+#include <sys/socket.h>
+
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+#include "caio/sleep.h"
+
+
+/* Listening socket acceptor. On each readiness event it drains the backlog
+ * with accept4(2) until EAGAIN or until the per-wakeup cap is reached, then
+ * spawns all the accepted connections at once. When the cap is reached the
+ * acceptor yields to let the new tasks run, and continues draining without
+ * waiting for the next readiness event.
+ *
+ * Running out of file descriptors or memory (EMFILE, ENFILE, ENOBUFS,
+ * ENOMEM) is not fatal, the acceptor spawns what it has, sleeps for
+ * backoff milliseconds and tries again. The backlog is still readable, so
+ * waiting for the readiness instead would spin.
+ */
+struct caio_acceptor;
+
+
+/* Allocates the per connection state, NULL drops the connection */
+typedef void * (*caio_acceptor_allocator) (struct caio_acceptor *a, int fd,
+        struct sockaddr *addr, socklen_t addrlen);
+
+
+/* Spawns a task for the connection, non-zero means failure */
+typedef int (*caio_acceptor_spawner) (struct caio *c, void *conn);
+
+
+/* Frees the state returned by allocator if the task could not be spawned,
+ * the acceptor closes the file descriptor itself */
+typedef void (*caio_acceptor_releaser) (struct caio_acceptor *a, void *conn);
+
+
+enum caio_acceptor_policy {
+    /* Close the connection and keep accepting */
+    CAIO_ACCEPTOR_DROP = 0,
+
+    /* Close the remaining connections in the batch and terminate the
+     * acceptor with ENOSPC */
+    CAIO_ACCEPTOR_STOP = 1,
+};
+
+
+struct caio_acceptor_pending {
+    int fd;
+    void *conn;
+};
+
+
+typedef struct caio_acceptor {
+    /* listening socket, must be non-blocking */
+    int fd;
+    struct caio_fdmon *fdmon;
+
+    /* maximum connections accepted per wakeup, zero means
+     * CAIO_ACCEPTOR_BATCH_DEFAULT */
+    unsigned int batch;
+
+    /* accept4(2) flags, SOCK_NONBLOCK is always added */
+    int flags;
+
+    /* what to do when the spawner fails */
+    enum caio_acceptor_policy policy;
+
+    /* milliseconds to sleep when out of descriptors, zero means
+     * CAIO_ACCEPTOR_BACKOFF_DEFAULT */
+    unsigned int backoff;
+
+    caio_acceptor_allocator alloc;
+    caio_acceptor_spawner spawn;
+    caio_acceptor_releaser release;
+    void *userdata;
+
+    /* counters */
+    unsigned long accepted;
+    unsigned long dropped;
+    unsigned long batches;
+    unsigned int maxbatch;
+
+    /* accept4(2) calls failed for lack of descriptors or memory */
+    unsigned long exhausted;
+
+    /* private */
+    struct caio_acceptor_pending *pending;
+    caio_sleep_t sleep;
+} caio_acceptor_t;
+
+
+#define CAIO_ACCEPTOR_BATCH_DEFAULT 64
+#define CAIO_ACCEPTOR_BACKOFF_DEFAULT 10
+
+
+/* Files an acceptor watches on its fdmon: the listening socket and the
+ * backoff timer, size the fdmon for them on top of the connections */
+#define CAIO_ACCEPTOR_FILES 2
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_acceptor
+#include "caio/generic.h"
+
+
+/* Zeroes the acceptor, call it before setting the fields. The task may be
+ * killed before its first step, its cleanup relies on this. */
+void
+caio_acceptor_init(struct caio_acceptor *a);
+
+
+ASYNC
+caio_acceptorA(struct caio_task *self, struct caio_acceptor *a);
+
+
+#endif  // CAIO_ACCEPTOR_H_
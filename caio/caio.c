@@ -26,6 +26,9 @@
 #ifdef CONFIG_CAIO_SEMAPHORE
   #include "caio/semaphore.h"
 #endif
+#ifdef CONFIG_CAIO_URING
+  #include "caio/uring.h"
+#endif
 #ifdef CONFIG_CAIO_FREERTOS
   #include "freertos/FreeRTOS.h"
   #include "freertos/task.h"
@@ -265,6 +268,12 @@ loop:
                 if (task->semaphore) {
                     caio_semaphore_release(task);
                 }
+#endif
+#ifdef CONFIG_CAIO_URING
+                /* Killed with in-flight jobs or an armed poll */
+                if (task->uring || task->uringpoll) {
+                    caio_uring_task_dispose(task);
+                }
 #endif
                 caio_taskpool_release(taskpool, task);
             }
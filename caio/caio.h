@@ -57,6 +57,7 @@ struct caio_basecall {
 
 #ifdef CONFIG_CAIO_URING
     struct caio_uring_taskstate;
+    struct caio_uring_job;
 #endif
 
 
@@ -78,6 +79,9 @@ struct caio_task {
 
 #ifdef CONFIG_CAIO_URING
     struct caio_uring_taskstate *uring;
+
+    /* readiness poll armed by caio_uring_fdmon(), if any */
+    struct caio_uring_job *uringpoll;
 #endif
 
 #ifdef CONFIG_CAIO_SEMAPHORE
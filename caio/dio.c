@@ -0,0 +1,329 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "caio/caio.h"
+#include "caio/dio.h"
+
+
+struct caio_dio {
+    struct caio_uring *uring;
+    char *buffers;
+    size_t size;
+    size_t align;
+    unsigned int count;
+    bool registered;
+
+    /* stack of the free indexes */
+    int *free;
+    unsigned int freecount;
+    char *leased;
+};
+
+
+#define _ISPOW2(n) (((n) & ((n) - 1)) == 0)
+
+
+struct caio_dio *
+caio_dio_create(struct caio_uring *u, unsigned int count, size_t size,
+        size_t align, int flags) {
+    struct caio_dio *d;
+    struct iovec *iovecs = NULL;
+    unsigned int i;
+
+    if (align == 0) {
+        align = sysconf(_SC_PAGESIZE);
+    }
+
+    if ((u == NULL) || (count == 0) || (size == 0) || (!_ISPOW2(align)) ||
+            (size % align)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    d = malloc(sizeof(struct caio_dio));
+    if (d == NULL) {
+        return NULL;
+    }
+    memset(d, 0, sizeof(struct caio_dio));
+    d->uring = u;
+    d->size = size;
+    d->align = align;
+    d->count = count;
+
+    /* posix_memalign(3) wants at least the pointer size */
+    errno = posix_memalign((void **)&d->buffers,
+            (align < sizeof(void *))? sizeof(void *): align, size * count);
+    if (errno) {
+        d->buffers = NULL;
+        goto failed;
+    }
+
+    d->free = malloc(sizeof(int) * count);
+    d->leased = calloc(count, 1);
+    if ((d->free == NULL) || (d->leased == NULL)) {
+        goto failed;
+    }
+
+    /* Lowest index on top */
+    for (i = 0; i < count; i++) {
+        d->free[i] = count - i - 1;
+    }
+    d->freecount = count;
+
+    if (!(flags & CAIO_DIO_REGISTER)) {
+        return d;
+    }
+
+    iovecs = malloc(sizeof(struct iovec) * count);
+    if (iovecs == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < count; i++) {
+        iovecs[i].iov_base = d->buffers + i * size;
+        iovecs[i].iov_len = size;
+    }
+
+    if (caio_uring_buffers_register(u, iovecs, count)) {
+        goto failed;
+    }
+    free(iovecs);
+    d->registered = true;
+    return d;
+
+failed:
+    free(iovecs);
+    free(d->buffers);
+    free(d->free);
+    free(d->leased);
+    free(d);
+    return NULL;
+}
+
+
+int
+caio_dio_destroy(struct caio_dio *d) {
+    int ret = 0;
+
+    if (d == NULL) {
+        return -1;
+    }
+
+    if (d->freecount < d->count) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    if (d->registered) {
+        ret = caio_uring_buffers_unregister(d->uring);
+    }
+
+    free(d->buffers);
+    free(d->free);
+    free(d->leased);
+    free(d);
+    return ret;
+}
+
+
+size_t
+caio_dio_fdalign(int fd) {
+    struct stat st;
+    int sectorsize;
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if ((statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0) &&
+            (stx.stx_mask & STATX_DIOALIGN)) {
+        if (stx.stx_dio_offset_align == 0) {
+            errno = EOPNOTSUPP;
+            return 0;
+        }
+
+        /* Both of them are powers of two */
+        return (stx.stx_dio_mem_align > stx.stx_dio_offset_align)?
+            stx.stx_dio_mem_align: stx.stx_dio_offset_align;
+    }
+#endif
+
+    if (fstat(fd, &st)) {
+        return 0;
+    }
+
+    if (!S_ISBLK(st.st_mode)) {
+        return st.st_blksize;
+    }
+
+    if (ioctl(fd, BLKSSZGET, &sectorsize)) {
+        return 0;
+    }
+
+    return sectorsize;
+}
+
+
+int
+caio_dio_lease(struct caio_dio *d, void **buff) {
+    int index;
+
+    if (d->freecount == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    index = d->free[--d->freecount];
+    d->leased[index] = 1;
+    if (buff) {
+        *buff = d->buffers + index * d->size;
+    }
+
+    return index;
+}
+
+
+int
+caio_dio_release(struct caio_dio *d, int index) {
+    if ((index < 0) || (index >= d->count) || (!d->leased[index])) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    d->leased[index] = 0;
+    d->free[d->freecount++] = index;
+    return 0;
+}
+
+
+void *
+caio_dio_get(struct caio_dio *d, int index) {
+    if ((index < 0) || (index >= d->count)) {
+        return NULL;
+    }
+
+    return d->buffers + index * d->size;
+}
+
+
+size_t
+caio_dio_size(struct caio_dio *d) {
+    return d->size;
+}
+
+
+size_t
+caio_dio_align(struct caio_dio *d) {
+    return d->align;
+}
+
+
+bool
+caio_dio_registered(struct caio_dio *d) {
+    return d->registered;
+}
+
+
+/* Index of the leased buffer holding buf/nbytes, -1 when the range is not
+ * inside the pool, -EINVAL when it is but does not fit one leased buffer */
+static int
+_index(struct caio_dio *d, const void *buf, unsigned nbytes) {
+    const char *p = buf;
+    size_t index;
+
+    if ((p < d->buffers) || (p >= (d->buffers + d->size * d->count))) {
+        return -1;
+    }
+
+    index = (p - d->buffers) / d->size;
+    if ((!d->leased[index]) ||
+            ((p + nbytes) > (d->buffers + (index + 1) * d->size))) {
+        return -EINVAL;
+    }
+
+    return index;
+}
+
+
+static int
+_prep_submit(struct caio_dio *d, struct caio_task *task, int fd,
+        const void *buf, unsigned nbytes, __u64 offset, bool write) {
+    struct io_uring_sqe *sqe;
+    int index = -1;
+    int rawfd;
+
+    if (((uintptr_t)buf % d->align) || (nbytes % d->align) ||
+            (offset % d->align)) {
+        return -EINVAL;
+    }
+
+    if (d->registered) {
+        index = _index(d, buf, nbytes);
+        if (index == -EINVAL) {
+            return -EINVAL;
+        }
+    }
+
+    sqe = caio_uring_sqe_get(d->uring, task);
+    if (sqe == NULL) {
+        return -EBUSY;
+    }
+
+    rawfd = CAIO_URING_ISFIXEDFD(fd)? CAIO_URING_FIXEDINDEX(fd): fd;
+    if (write && (index >= 0)) {
+        caio_uring_prep_write_fixed(sqe, rawfd, buf, nbytes, offset, index);
+    }
+    else if (write) {
+        caio_uring_prep_write(sqe, rawfd, buf, nbytes, offset);
+    }
+    else if (index >= 0) {
+        caio_uring_prep_read_fixed(sqe, rawfd, (void *)buf, nbytes, offset,
+                index);
+    }
+    else {
+        caio_uring_prep_read(sqe, rawfd, (void *)buf, nbytes, offset);
+    }
+
+    if (CAIO_URING_ISFIXEDFD(fd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    return caio_uring_submit(d->uring);
+}
+
+
+int
+caio_dio_read(struct caio_dio *d, struct caio_task *task, int fd,
+        void *buf, unsigned nbytes, __u64 offset) {
+    return _prep_submit(d, task, fd, buf, nbytes, offset, false);
+}
+
+
+int
+caio_dio_write(struct caio_dio *d, struct caio_task *task, int fd,
+        const void *buf, unsigned nbytes, __u64 offset) {
+    return _prep_submit(d, task, fd, buf, nbytes, offset, true);
+}
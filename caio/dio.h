@@ -0,0 +1,118 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_DIO_H_
+#define CAIO_DIO_H_
+
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+/* Aligned buffer pool for the files opened with O_DIRECT, owned by the
+ * loop and reused by its tasks, so the page cache is bypassed without a
+ * posix_memalign(3) per block. count buffers of size bytes, both the
+ * buffers and size are multiples of align, which must cover the direct I/O
+ * alignment of the files, see caio_dio_fdalign().
+ *
+ * caio_dio_read() and caio_dio_write() refuse the misaligned buffers,
+ * lengths and offsets with -EINVAL before anything reaches the kernel.
+ * With CAIO_DIO_REGISTER the pool is also registered with the ring as
+ * fixed buffers, so the pages are pinned once instead of per request.
+ *
+ *   align = caio_dio_fdalign(fd);
+ *   dio = caio_dio_create(uring, tasks, 64 * 1024, align, CAIO_DIO_REGISTER);
+ *   index = caio_dio_lease(dio, &buff);
+ *   ...
+ *   caio_dio_read(dio, self, fd, buff, 64 * 1024, offset);
+ *   CAIO_URING_AWAIT(uring, self, 1);
+ */
+struct caio_dio;
+
+
+enum caio_dio_flags {
+    /* Register the buffers with the ring, the ring must not have its own,
+     * see caio_uring_buffers_register() */
+    CAIO_DIO_REGISTER = 1,
+};
+
+
+/* zero align means the page size */
+struct caio_dio *
+caio_dio_create(struct caio_uring *u, unsigned int count, size_t size,
+        size_t align, int flags);
+
+
+/* All the buffers must be released and their jobs completed */
+int
+caio_dio_destroy(struct caio_dio *d);
+
+
+/* Direct I/O alignment of fd: STATX_DIOALIGN when the kernel reports it,
+ * otherwise the logical block size of a block device or the block size of
+ * the filesystem. Zero with errno on failure, EOPNOTSUPP when the file
+ * does not support direct I/O. */
+size_t
+caio_dio_fdalign(int fd);
+
+
+/* Returns the buffer index or -1 with ENOBUFS */
+int
+caio_dio_lease(struct caio_dio *d, void **buff);
+
+
+int
+caio_dio_release(struct caio_dio *d, int index);
+
+
+void *
+caio_dio_get(struct caio_dio *d, int index);
+
+
+size_t
+caio_dio_size(struct caio_dio *d);
+
+
+size_t
+caio_dio_align(struct caio_dio *d);
+
+
+bool
+caio_dio_registered(struct caio_dio *d);
+
+
+/* All-in-one functions, same as caio_uring_read() and caio_uring_write()
+ * but buf, nbytes and offset must be aligned. A range inside a leased
+ * buffer of a registered pool is read/written as a fixed buffer. All the
+ * failures are negative errnos: -EINVAL for a misaligned request or a
+ * range which does not fit its leased buffer, -EBUSY when no SQE or job is
+ * free, otherwise the error of the submission. */
+int
+caio_dio_read(struct caio_dio *d, struct caio_task *task, int fd,
+        void *buf, unsigned nbytes, __u64 offset);
+
+
+int
+caio_dio_write(struct caio_dio *d, struct caio_task *task, int fd,
+        const void *buf, unsigned nbytes, __u64 offset);
+
+
+#endif  // CAIO_DIO_H_
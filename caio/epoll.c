@@ -34,6 +34,9 @@ struct caio_epoll {
     size_t maxevents;
     size_t waitingfiles;
     struct epoll_event *events;
+
+    /* Watched descriptors with no task, see caio_epoll_wakeup_watch() */
+    unsigned int wakeups;
 };
 
 
@@ -43,7 +46,7 @@ _tick(struct caio *c, struct caio_epoll *e, unsigned int timeout_us) {
     int nfds;
     struct caio_task *task;
 
-    if (e->waitingfiles == 0) {
+    if ((e->waitingfiles == 0) && (e->wakeups == 0)) {
         return 0;
     }
 
@@ -56,6 +59,11 @@ _tick(struct caio *c, struct caio_epoll *e, unsigned int timeout_us) {
     if (nfds) {
         for (i = 0; i < nfds; i++) {
             task = (struct caio_task*)e->events[i].data.ptr;
+            if (task == NULL) {
+                /* Wakeup descriptor, the owner handles it in its tick */
+                continue;
+            }
+
             if (task->status == CAIO_WAITING) {
                 task->status = CAIO_RUNNING;
                 e->waitingfiles--;
@@ -83,8 +91,15 @@ _monitor(struct caio_epoll *e, struct caio_task *task, int fd,
     }
 
     e->waitingfiles++;
-    task->fdmon_timeout_us = timeout_us;
-    clock_gettime(CLOCK_MONOTONIC, &task->fdmon_timestamp);
+    if (timeout_us > 0) {
+        fdmon_task_timestamp_setnow(task);
+        task->fdmon_timeout_us = timeout_us;
+    }
+    else {
+        fdmon_task_timestamp_clear(task);
+        task->fdmon_timeout_us = 0;
+    }
+
     return 0;
 }
 
@@ -99,6 +114,32 @@ _forget(struct caio_epoll *e, int fd) {
 }
 
 
+int
+caio_epoll_wakeup_watch(struct caio_epoll *e, int fd) {
+    struct epoll_event ee;
+
+    ee.events = EPOLLIN | EPOLLET;
+    ee.data.ptr = NULL;
+    if (epoll_ctl(e->fd, EPOLL_CTL_ADD, fd, &ee)) {
+        return -1;
+    }
+
+    e->wakeups++;
+    return 0;
+}
+
+
+int
+caio_epoll_wakeup_forget(struct caio_epoll *e, int fd) {
+    if (epoll_ctl(e->fd, EPOLL_CTL_DEL, fd, NULL)) {
+        return -1;
+    }
+
+    e->wakeups--;
+    return 0;
+}
+
+
 struct caio_epoll *
 caio_epoll_create(struct caio* c, size_t maxevents) {
     struct caio_epoll *e;
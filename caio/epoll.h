@@ -34,4 +34,15 @@ int
 caio_epoll_destroy(struct caio* c, struct caio_epoll *e);
 
 
+/* Wake up the epoll_wait(2) of the tick whenever fd becomes readable
+ * (edge-triggered), with no task involved. E.g. caio_uring_eventfd(), so
+ * one blocking wait serves both modules. */
+int
+caio_epoll_wakeup_watch(struct caio_epoll *e, int fd);
+
+
+int
+caio_epoll_wakeup_forget(struct caio_epoll *e, int fd);
+
+
 #endif  // CAIO_EPOLL_H_
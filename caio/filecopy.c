@@ -0,0 +1,497 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+
+#include "caio/caio.h"
+#include "caio/filecopy.h"
+
+
+/* Each worker owns one buffer and copies one block at a time */
+typedef struct caio_filecopy_worker {
+    struct caio_filecopy *fc;
+    struct caio_task *task;
+    char *buff;
+
+    /* source range of the current block */
+    off_t offset;
+    size_t len;
+
+    /* ordered: read but not yet written */
+    size_t bytes;
+    size_t written;
+    bool turn;
+} caio_filecopy_worker_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_filecopy
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.c"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_filecopy_worker
+#include "caio/generic.h"  // NOLINT
+#include "caio/generic.c"  // NOLINT
+
+
+static void
+_release(struct caio_filecopy *fc) {
+    free(fc->workers);
+    free(fc->buffers);
+    fc->workers = NULL;
+    fc->buffers = NULL;
+}
+
+
+/* Called by the terminating workers, the last one wakes up the
+ * caio_filecopyA() or releases the buffers if it is already gone. */
+static void
+_worker_done(struct caio_filecopy *fc) {
+    if (--fc->running) {
+        return;
+    }
+
+    if (fc->waiter == NULL) {
+        _release(fc);
+        return;
+    }
+
+    if (fc->waiter->status == CAIO_WAITING) {
+        fc->waiter->status = CAIO_RUNNING;
+    }
+}
+
+
+/* Stop claiming blocks and wake up the workers waiting for their turn */
+static void
+_abort(struct caio_filecopy *fc, int eno) {
+    unsigned int i;
+    struct caio_filecopy_worker *w;
+
+    if (fc->eno) {
+        return;
+    }
+
+    fc->eno = eno? eno: ECANCELED;
+    for (i = 0; i < fc->depth; i++) {
+        w = &fc->workers[i];
+        if (w->turn && (w->task->status == CAIO_WAITING)) {
+            w->task->status = CAIO_RUNNING;
+        }
+    }
+}
+
+
+/* Ordered mode, the block at writepos may be written now */
+static void
+_turn_next(struct caio_filecopy *fc) {
+    unsigned int i;
+    struct caio_filecopy_worker *w;
+
+    for (i = 0; i < fc->depth; i++) {
+        w = &fc->workers[i];
+        if (w->turn && (w->offset == fc->writepos) &&
+                (w->task->status == CAIO_WAITING)) {
+            w->task->status = CAIO_RUNNING;
+            return;
+        }
+    }
+}
+
+
+static bool
+_claim(struct caio_filecopy *fc, struct caio_filecopy_worker *w) {
+    off_t left = fc->end - fc->next;
+
+    if (fc->eno || (left <= 0)) {
+        return false;
+    }
+
+    w->offset = fc->next;
+    w->len = ((off_t)fc->blocksize < left)? fc->blocksize: (size_t)left;
+    fc->next += w->len;
+    return true;
+}
+
+
+/* Queue a write of the buffer, returns zero or the errno */
+static int
+_write_submit(struct caio_filecopy_worker *w, struct caio_task *self,
+        size_t len, off_t offset) {
+    struct caio_filecopy *fc = w->fc;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    sqe = caio_uring_sqe_get(fc->uring, self);
+    if (sqe == NULL) {
+        return ENOSPC;
+    }
+
+    caio_uring_prep_write(sqe, fc->outfd, w->buff + w->written, len, offset);
+    ret = caio_uring_submit(fc->uring);
+    return (ret < 0)? -ret: 0;
+}
+
+
+static int
+_read_submit(struct caio_filecopy_worker *w, struct caio_task *self) {
+    struct caio_filecopy *fc = w->fc;
+    struct io_uring_sqe *sqe;
+    int ret;
+
+    sqe = caio_uring_sqe_get(fc->uring, self);
+    if (sqe == NULL) {
+        return ENOSPC;
+    }
+
+    caio_uring_prep_read(sqe, fc->infd, w->buff, w->len, w->offset);
+    ret = caio_uring_submit(fc->uring);
+    return (ret < 0)? -ret: 0;
+}
+
+
+/* read -> write at the same block offset, in one submission */
+static int
+_chain_submit(struct caio_filecopy_worker *w, struct caio_task *self) {
+    struct caio_filecopy *fc = w->fc;
+    struct caio_uring_chain chain;
+    struct io_uring_sqe *sqe;
+
+    if (caio_uring_chain_begin(&chain, fc->uring, self, 2)) {
+        return errno;
+    }
+
+    sqe = caio_uring_chain_sqe_get(&chain, false);
+    caio_uring_prep_read(sqe, fc->infd, w->buff, w->len, w->offset);
+    sqe = caio_uring_chain_sqe_get(&chain, false);
+    caio_uring_prep_write(sqe, fc->outfd, w->buff, w->len,
+            w->offset - fc->offset + fc->outoffset);
+    return (caio_uring_chain_submit(&chain) < 0)? EIO: 0;
+}
+
+
+static int
+_cqe_res(struct caio_task *self, int index) {
+    struct io_uring_cqe *cqe = caio_uring_cqe_get(self, index);
+
+    return cqe? cqe->res: -EIO;
+}
+
+
+static int
+_chain_res(struct caio_task *self, unsigned int position) {
+    struct io_uring_cqe *cqe = caio_uring_chain_cqe(self, position);
+
+    return cqe? cqe->res: -EIO;
+}
+
+
+static void
+_advance(struct caio_filecopy_worker *w, size_t bytes) {
+    w->offset += bytes;
+    w->len -= bytes;
+    w->fc->copied += bytes;
+}
+
+
+static ASYNC
+_workerA(struct caio_task *self, struct caio_filecopy_worker *w) {
+    struct caio_filecopy *fc = w->fc;
+    int ret;
+    CAIO_BEGIN(self);
+    w->task = self;
+
+    while (w->len || _claim(fc, w)) {
+        if (!fc->ordered) {
+            ret = _chain_submit(w, self);
+            if (ret) {
+                CAIO_THROW(self, ret);
+            }
+
+            CAIO_URING_AWAIT(fc->uring, self, 2);
+            ret = _chain_res(self, 0);
+            w->bytes = (ret > 0)? ret: 0;
+            if (ret > 0) {
+                ret = _chain_res(self, 1);
+            }
+            caio_uring_chain_seen(fc->uring, self);
+
+            /* Short read, the linked write is cancelled */
+            if ((ret == -ECANCELED) && w->bytes) {
+                w->written = 0;
+                ret = _write_submit(w, self, w->bytes,
+                        w->offset - fc->offset + fc->outoffset);
+                if (ret) {
+                    CAIO_THROW(self, ret);
+                }
+
+                CAIO_URING_AWAIT(fc->uring, self, 1);
+                ret = _cqe_res(self, 0);
+                caio_uring_cqe_seen(fc->uring, self, 0);
+            }
+
+            /* The source is shorter than expected */
+            if (ret <= 0) {
+                CAIO_THROW(self, ret? -ret: EIO);
+            }
+
+            _advance(w, ret);
+            continue;
+        }
+
+        ret = _read_submit(w, self);
+        if (ret) {
+            CAIO_THROW(self, ret);
+        }
+
+        CAIO_URING_AWAIT(fc->uring, self, 1);
+        ret = _cqe_res(self, 0);
+        caio_uring_cqe_seen(fc->uring, self, 0);
+        if (ret <= 0) {
+            CAIO_THROW(self, ret? -ret: EIO);
+        }
+        w->bytes = ret;
+        w->written = 0;
+
+        /* Wait for the previous blocks */
+        w->turn = true;
+        while ((fc->writepos != w->offset) && (fc->eno == 0)) {
+            CAIO_PASS(self, CAIO_WAITING);
+        }
+        w->turn = false;
+
+        if (fc->eno) {
+            CAIO_RETURN(self);
+        }
+
+        if (fc->consume) {
+            errno = 0;
+            if (fc->consume(fc, w->buff, w->bytes)) {
+                CAIO_THROW(self, errno? errno: EIO);
+            }
+            w->written = w->bytes;
+        }
+
+        while (w->written < w->bytes) {
+            ret = _write_submit(w, self, w->bytes - w->written, -1);
+            if (ret) {
+                CAIO_THROW(self, ret);
+            }
+
+            CAIO_URING_AWAIT(fc->uring, self, 1);
+            ret = _cqe_res(self, 0);
+            caio_uring_cqe_seen(fc->uring, self, 0);
+            if (ret <= 0) {
+                CAIO_THROW(self, ret? -ret: EIO);
+            }
+            w->written += ret;
+        }
+
+        _advance(w, w->bytes);
+        fc->writepos += w->bytes;
+        _turn_next(fc);
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(fc->uring, self);
+    w->turn = false;
+    if (w->len) {
+        _abort(fc, self->eno);
+    }
+    _worker_done(fc);
+}
+
+
+/* The workers read the source at the block offsets, so it must be a
+ * regular file or a block device, ESPIPE otherwise */
+static int
+_insize(int fd, off_t *size) {
+    struct stat st;
+    uint64_t bytes;
+
+    if (fstat(fd, &st)) {
+        return -1;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        *size = st.st_size;
+        return 0;
+    }
+
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKGETSIZE64, &bytes)) {
+            return -1;
+        }
+        *size = bytes;
+        return 0;
+    }
+
+    errno = ESPIPE;
+    return -1;
+}
+
+
+static int
+_start(struct caio_task *self, struct caio_filecopy *fc) {
+    struct stat st;
+    struct caio_filecopy_worker *w;
+    off_t end;
+    off_t blocks;
+    unsigned int i;
+    long pagesize;
+
+    if (fc->blocksize == 0) {
+        fc->blocksize = CAIO_FILECOPY_BLOCKSIZE_DEFAULT;
+    }
+
+    if (fc->depth == 0) {
+        fc->depth = CAIO_FILECOPY_DEPTH_DEFAULT;
+    }
+
+    /* Leaves the file offset of the caller alone */
+    if (_insize(fc->infd, &end)) {
+        return -1;
+    }
+
+    if (fc->length == 0) {
+        fc->length = (end > fc->offset)? end - fc->offset: 0;
+    }
+
+    fc->ordered = true;
+    if (fc->consume == NULL) {
+        if (fstat(fc->outfd, &st)) {
+            return -1;
+        }
+        fc->ordered = !S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode);
+    }
+
+    fc->next = fc->offset;
+    fc->end = fc->offset + fc->length;
+    fc->writepos = fc->offset;
+    fc->copied = 0;
+    fc->eno = 0;
+
+    /* No more workers than blocks */
+    blocks = (fc->length + fc->blocksize - 1) / fc->blocksize;
+    if (blocks < fc->depth) {
+        fc->depth = blocks;
+    }
+
+    if (fc->depth == 0) {
+        return 0;
+    }
+
+    fc->workers = calloc(fc->depth, sizeof(struct caio_filecopy_worker));
+    if (fc->workers == NULL) {
+        return -1;
+    }
+
+    /* Page aligned, so the buffers are usable with O_DIRECT as well */
+    pagesize = sysconf(_SC_PAGESIZE);
+    errno = posix_memalign((void **)&fc->buffers, (pagesize > 0)?
+            pagesize: 4096, fc->depth * fc->blocksize);
+    if (errno) {
+        fc->buffers = NULL;
+        return -1;
+    }
+
+    for (i = 0; i < fc->depth; i++) {
+        w = &fc->workers[i];
+        w->fc = fc;
+        w->buff = fc->buffers + i * fc->blocksize;
+        if (caio_filecopy_worker_spawn(self->caio, _workerA, w)) {
+            /* Let the spawned ones end */
+            fc->eno = errno? errno: ENOMEM;
+            return -1;
+        }
+        fc->running++;
+    }
+
+    return 0;
+}
+
+
+ASYNC
+caio_filecopyA(struct caio_task *self, struct caio_filecopy *fc,
+        struct caio_uring *u) {
+    struct io_uring_sqe *sqe;
+    int ret;
+    CAIO_BEGIN(self);
+    fc->uring = u;
+    fc->waiter = self;
+    fc->running = 0;
+    fc->workers = NULL;
+    fc->buffers = NULL;
+    fc->eno = 0;
+
+    if (_start(self, fc)) {
+        if (fc->eno == 0) {
+            fc->eno = errno;
+        }
+        CAIO_THROW(self, fc->eno);
+    }
+
+    /* Woken up by the last worker */
+    while (fc->running) {
+        CAIO_PASS(self, CAIO_WAITING);
+    }
+
+    if (fc->eno) {
+        CAIO_THROW(self, fc->eno);
+    }
+
+    if ((fc->flags & CAIO_FILECOPY_FSYNC) && (fc->consume == NULL)) {
+        sqe = caio_uring_sqe_get(u, self);
+        if (sqe == NULL) {
+            CAIO_THROW(self, ENOSPC);
+        }
+
+        caio_uring_prep_fsync(sqe, fc->outfd, 0);
+        ret = caio_uring_submit(u);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+
+        CAIO_URING_AWAIT(u, self, 1);
+        ret = _cqe_res(self, 0);
+        caio_uring_cqe_seen(u, self, 0);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(u, self);
+    fc->waiter = NULL;
+    if (fc->running == 0) {
+        _release(fc);
+    }
+}
@@ -0,0 +1,128 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_FILECOPY_H_
+#define CAIO_FILECOPY_H_
+
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+/* Streaming file copy/read engine on io_uring(7). depth worker tasks read
+ * the source in blocksize blocks, each into its own buffer, so at most
+ * depth blocks are in flight and depth * blocksize bytes of memory are
+ * used, whatever the size of the file. The workers claim the blocks in
+ * order and write each block as soon as it is read, so the reads of some
+ * blocks overlap the writes of the others.
+ *
+ * The source must be a regular file or a block device, it is read at the
+ * block offsets, the copy fails with ESPIPE otherwise. Its file offset is
+ * not used nor changed.
+ *
+ * Regular files and block devices are written at the block offsets, using
+ * linked read -> write chains. Other destinations (pipes, sockets, ttys)
+ * and the consume callback get the blocks in order, a block waits for the
+ * previous ones to be written.
+ *
+ * The ring needs 2 * depth + 1 free jobs, and the loop depth + 1 free
+ * tasks.
+ *
+ *   state->copy.infd = src;
+ *   state->copy.outfd = dst;
+ *   CAIO_FILECOPY_AWAIT(self, &state->copy, uring);
+ */
+#define CAIO_FILECOPY_BLOCKSIZE_DEFAULT (128 * 1024)
+#define CAIO_FILECOPY_DEPTH_DEFAULT 4
+
+
+struct caio_filecopy;
+struct caio_filecopy_worker;
+typedef int (*caio_filecopy_consumer) (struct caio_filecopy *fc,
+        const void *buf, size_t len);
+
+
+enum caio_filecopy_flags {
+    /* fsync(2) the destination when done */
+    CAIO_FILECOPY_FSYNC = 1,
+};
+
+
+typedef struct caio_filecopy {
+    int infd;
+
+    /* ignored when consume is given */
+    int outfd;
+
+    /* source range, zero length means to the end of the source */
+    off_t offset;
+    off_t length;
+
+    /* position of the first byte in a regular destination */
+    off_t outoffset;
+
+    /* zero means the defaults above */
+    size_t blocksize;
+    unsigned int depth;
+    int flags;
+
+    /* in order consumer of the blocks instead of outfd, a non-zero return
+     * stops the copy with errno */
+    caio_filecopy_consumer consume;
+    void *userdata;
+
+    /* bytes written or consumed so far */
+    off_t copied;
+
+    /* private */
+    struct caio_uring *uring;
+    struct caio_task *waiter;
+    struct caio_filecopy_worker *workers;
+    char *buffers;
+    off_t next;
+    off_t end;
+    off_t writepos;
+    bool ordered;
+    unsigned int running;
+    int eno;
+} caio_filecopy_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_filecopy
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.h"
+
+
+ASYNC
+caio_filecopyA(struct caio_task *self, struct caio_filecopy *fc,
+        struct caio_uring *u);
+
+
+/* Copy the whole range, terminates with the errno of the first failed
+ * block */
+#define CAIO_FILECOPY_AWAIT(self, fc, u) \
+    CAIO_AWAIT(self, caio_filecopy, caio_filecopyA, fc, u)
+
+
+#endif  // CAIO_FILECOPY_H_
@@ -0,0 +1,154 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdint.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "caio/caio.h"
+#include "caio/notify.h"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_notify
+#define CAIO_ARG1 struct caio_fdmon *
+#include "caio/generic.c"
+
+
+#ifdef CONFIG_CAIO_URING
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_notify_uring
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.c"  // NOLINT
+#endif
+
+
+int
+caio_notify_create(struct caio_notify *n) {
+    int fd;
+
+    if (n == NULL) {
+        return -1;
+    }
+
+    fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    n->fd = fd;
+    atomic_init(&n->pending, 0);
+    return 0;
+}
+
+
+int
+caio_notify_destroy(struct caio_notify *n) {
+    if (n == NULL) {
+        return -1;
+    }
+
+    return close(n->fd);
+}
+
+
+int
+caio_notify_post(struct caio_notify *n) {
+    uint64_t one = 1;
+
+    /* Already signaled and not consumed yet, the pending eventfd write wakes
+     * the task anyway */
+    if (atomic_exchange(&n->pending, 1)) {
+        return 0;
+    }
+
+    if (write(n->fd, &one, sizeof(one)) == -1) {
+        /* Counter is saturated, so it's readable */
+        if (errno == EAGAIN) {
+            return 0;
+        }
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+_drain(struct caio_notify *n) {
+    uint64_t value;
+
+    /* Nothing to read is fine, another wakeup consumed it already */
+    if (read(n->fd, &value, sizeof(value)) == -1) {
+        errno = 0;
+    }
+}
+
+
+ASYNC
+caio_notifyA(struct caio_task *self, struct caio_notify *n,
+        struct caio_fdmon *iom) {
+    CAIO_BEGIN(self);
+
+    /* Clear the flag before draining, so a post racing with us always ends
+     * up either in the flag or in a readable eventfd */
+    while (!atomic_exchange(&n->pending, 0)) {
+        CAIO_FILE_AWAIT(iom, self, n->fd, CAIO_IN);
+        _drain(n);
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(iom, n->fd);
+}
+
+
+#ifdef CONFIG_CAIO_URING
+
+
+ASYNC
+caio_notify_uringA(struct caio_task *self, struct caio_notify *n,
+        struct caio_uring *u) {
+    struct io_uring_sqe *sqe;
+    CAIO_BEGIN(self);
+
+    while (!atomic_exchange(&n->pending, 0)) {
+        sqe = caio_uring_sqe_get(u, self);
+        if (sqe == NULL) {
+            /* The ring is full, not out of memory */
+            CAIO_THROW(self, EBUSY);
+        }
+
+        caio_uring_prep_poll_add(sqe, n->fd, POLLIN);
+        caio_uring_submit(u);
+        CAIO_URING_AWAIT(u, self, 1);
+        caio_uring_cqe_seen(u, self, 0);
+        _drain(n);
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(u, self);
+}
+
+
+#endif  // CONFIG_CAIO_URING
@@ -0,0 +1,96 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_NOTIFY_H_
+#define CAIO_NOTIFY_H_
+
+
+#include <stdatomic.h>
+
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+
+
+/* Cross thread wakeup, backed by an eventfd(2).
+ * caio_notify_post() may be called from any thread, any number of signals
+ * posted before the waiting task runs are coalesced into one wakeup. */
+typedef struct caio_notify {
+    int fd;
+    atomic_int pending;
+} caio_notify_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_notify
+#define CAIO_ARG1 struct caio_fdmon *
+#include "caio/generic.h"
+
+
+int
+caio_notify_create(struct caio_notify *n);
+
+
+int
+caio_notify_destroy(struct caio_notify *n);
+
+
+int
+caio_notify_post(struct caio_notify *n);
+
+
+ASYNC
+caio_notifyA(struct caio_task *self, struct caio_notify *n,
+        struct caio_fdmon *iom);
+
+
+#define CAIO_NOTIFY_AWAIT(self, notify, iom) \
+    CAIO_AWAIT(self, caio_notify, caio_notifyA, notify, \
+            (struct caio_fdmon*)iom)
+
+
+#ifdef CONFIG_CAIO_URING
+
+#include "caio/uring.h"
+
+
+typedef struct caio_notify caio_notify_uring_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_notify_uring
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.h"  // NOLINT
+
+
+/* Throws EBUSY when the ring has no free SQE or job */
+ASYNC
+caio_notify_uringA(struct caio_task *self, struct caio_notify *n,
+        struct caio_uring *u);
+
+
+#define CAIO_NOTIFY_URING_AWAIT(self, notify, u) \
+    CAIO_AWAIT(self, caio_notify_uring, caio_notify_uringA, notify, u)
+
+#endif  // CONFIG_CAIO_URING
+
+
+#endif  // CAIO_NOTIFY_H_
@@ -0,0 +1,259 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+
+#include "caio/fdmon.h"
+#include "caio/poll.h"
+
+
+/* Disarmed entries are kept in place with a negative fd, so poll(2) ignores
+ * them and re-monitoring the same file is just a flip of the sign. */
+#define DISARMED(fd) (~(fd))
+#define ISARMED(pfd) ((pfd)->fd >= 0)
+#define FILENO(pfd) (ISARMED(pfd)? (pfd)->fd: DISARMED((pfd)->fd))
+
+
+struct caio_poll {
+    struct caio_fdmon;
+    size_t maxfiles;
+    size_t count;
+    size_t waitingfiles;
+    struct pollfd *pollfds;
+    struct caio_task **tasks;
+
+    /* fileno -> index + 1 of the pollfds, zero means not monitored */
+    unsigned int *indexes;
+    size_t indexescount;
+};
+
+
+static int
+_indexes_grow(struct caio_poll *p, int fd) {
+    size_t count = p->indexescount;
+    unsigned int *indexes;
+
+    while (count <= fd) {
+        count *= 2;
+    }
+
+    indexes = realloc(p->indexes, count * sizeof(unsigned int));
+    if (indexes == NULL) {
+        return -1;
+    }
+
+    memset(indexes + p->indexescount, 0,
+            (count - p->indexescount) * sizeof(unsigned int));
+    p->indexes = indexes;
+    p->indexescount = count;
+    return 0;
+}
+
+
+static int
+_monitor(struct caio_poll *p, struct caio_task *task, int fd, int events,
+        unsigned int timeout_us) {
+    struct pollfd *pfd;
+    unsigned int index;
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    if ((fd >= p->indexescount) && _indexes_grow(p, fd)) {
+        return -1;
+    }
+
+    index = p->indexes[fd];
+    if (index == 0) {
+        if (p->count == p->maxfiles) {
+            return -1;
+        }
+
+        index = ++p->count;
+        p->indexes[fd] = index;
+        pfd = &p->pollfds[index - 1];
+        pfd->fd = DISARMED(fd);
+    }
+    else {
+        pfd = &p->pollfds[index - 1];
+    }
+
+    if (!ISARMED(pfd)) {
+        pfd->fd = fd;
+        p->waitingfiles++;
+    }
+    pfd->events = events;
+    pfd->revents = 0;
+    p->tasks[index - 1] = task;
+
+    if (timeout_us > 0) {
+        fdmon_task_timestamp_setnow(task);
+        task->fdmon_timeout_us = timeout_us;
+    }
+    else {
+        fdmon_task_timestamp_clear(task);
+        task->fdmon_timeout_us = 0;
+    }
+
+    return 0;
+}
+
+
+static int
+_tick(struct caio *c, struct caio_poll *p, unsigned int timeout_us) {
+    int i;
+    int nfds;
+    struct pollfd *pfd;
+    struct caio_task *task;
+
+    if (p->waitingfiles == 0) {
+        return 0;
+    }
+
+    nfds = poll(p->pollfds, p->count, timeout_us / 1000);
+    if (nfds == -1) {
+        return -1;
+    }
+
+    /* Stop as soon as all ready files are visited */
+    for (i = 0; nfds && (i < p->count); i++) {
+        pfd = &p->pollfds[i];
+        if (pfd->revents == 0) {
+            continue;
+        }
+
+        nfds--;
+        pfd->revents = 0;
+        pfd->fd = DISARMED(pfd->fd);
+        p->waitingfiles--;
+
+        task = p->tasks[i];
+        if (task->status == CAIO_WAITING) {
+            task->status = CAIO_RUNNING;
+        }
+    }
+
+    fdmon_tasks_timeout_check(c);
+    return 0;
+}
+
+
+static int
+_forget(struct caio_poll *p, int fd) {
+    unsigned int index;
+    unsigned int last;
+    struct pollfd *pfd;
+
+    if ((fd < 0) || (fd >= p->indexescount)) {
+        return -1;
+    }
+
+    index = p->indexes[fd];
+    if (index == 0) {
+        return -1;
+    }
+
+    pfd = &p->pollfds[index - 1];
+    if (ISARMED(pfd)) {
+        p->waitingfiles--;
+    }
+
+    /* Swap the last entry into the hole */
+    last = p->count--;
+    if (index != last) {
+        *pfd = p->pollfds[last - 1];
+        p->tasks[index - 1] = p->tasks[last - 1];
+        p->indexes[FILENO(pfd)] = index;
+    }
+
+    p->indexes[fd] = 0;
+    return 0;
+}
+
+
+struct caio_poll *
+caio_poll_create(struct caio* c, size_t maxfiles) {
+    struct caio_poll *p;
+
+    if (maxfiles == 0) {
+        return NULL;
+    }
+
+    /* Create poll instance */
+    p = malloc(sizeof(struct caio_poll));
+    if (p == NULL) {
+        return NULL;
+    }
+    memset(p, 0, sizeof(struct caio_poll));
+
+    p->maxfiles = maxfiles;
+    p->pollfds = calloc(maxfiles, sizeof(struct pollfd));
+    if (p->pollfds == NULL) {
+        goto failed;
+    }
+
+    p->tasks = calloc(maxfiles, sizeof(struct caio_task *));
+    if (p->tasks == NULL) {
+        goto failed;
+    }
+
+    /* Grows on demand, whenever a higher fileno is monitored */
+    p->indexescount = maxfiles + 3;
+    p->indexes = calloc(p->indexescount, sizeof(unsigned int));
+    if (p->indexes == NULL) {
+        goto failed;
+    }
+
+    p->tick = (caio_tick) _tick;
+    p->monitor = (caio_filemonitor)_monitor;
+    p->forget = (caio_fileforget)_forget;
+
+    if (caio_module_install(c, (struct caio_module*)p)) {
+        goto failed;
+    }
+
+    return p;
+
+failed:
+    free(p->indexes);
+    free(p->tasks);
+    free(p->pollfds);
+    free(p);
+    return NULL;
+}
+
+
+int
+caio_poll_destroy(struct caio* c, struct caio_poll *p) {
+    int ret = 0;
+
+    if (p == NULL) {
+        return -1;
+    }
+
+    ret |= caio_module_uninstall(c, (struct caio_module*)p);
+
+    free(p->indexes);
+    free(p->tasks);
+    free(p->pollfds);
+    free(p);
+    return ret;
+}
@@ -0,0 +1,408 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "caio/caio.h"
+#include "caio/proxy.h"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_proxy_flow
+#define CAIO_ARG1 struct caio_fdmon *
+#include "caio/generic.c"
+
+
+#ifdef CONFIG_CAIO_URING
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_proxy_flow_uring
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.c"  // NOLINT
+#endif
+
+
+static int
+_flow_init(struct caio_proxy *p, struct caio_proxy_flow *f, int in,
+        int out, size_t chunk) {
+    int pipesize;
+
+    memset(f, 0, sizeof(struct caio_proxy_flow));
+    f->proxy = p;
+    f->in = in;
+    f->tap = -1;
+    f->pipe[0] = -1;
+    f->pipe[1] = -1;
+    f->out = dup(out);
+    if (f->out == -1) {
+        return -1;
+    }
+
+    if (pipe2(f->pipe, O_CLOEXEC)) {
+        return -1;
+    }
+
+    /* A bigger chunk does not fit the pipe anyway */
+    pipesize = fcntl(f->pipe[1], F_GETPIPE_SZ);
+    if ((chunk == 0) || ((pipesize > 0) && (chunk > (size_t)pipesize))) {
+        chunk = (pipesize > 0)? pipesize: 65536;
+    }
+    f->chunk = chunk;
+    return 0;
+}
+
+
+static void
+_flow_deinit(struct caio_proxy_flow *f) {
+    if (f->out != -1) {
+        close(f->out);
+        f->out = -1;
+    }
+
+    if (f->pipe[0] != -1) {
+        close(f->pipe[0]);
+        close(f->pipe[1]);
+        f->pipe[0] = -1;
+        f->pipe[1] = -1;
+    }
+}
+
+
+int
+caio_proxy_create(struct caio_proxy *p, int a, int b, size_t chunk) {
+    if (p == NULL) {
+        return -1;
+    }
+
+    memset(p, 0, sizeof(struct caio_proxy));
+    p->flows[0].out = -1;
+    p->flows[0].pipe[0] = -1;
+    p->flows[1].out = -1;
+    p->flows[1].pipe[0] = -1;
+    if (_flow_init(p, &p->flows[0], a, b, chunk) ||
+            _flow_init(p, &p->flows[1], b, a, chunk)) {
+        _flow_deinit(&p->flows[0]);
+        _flow_deinit(&p->flows[1]);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+caio_proxy_destroy(struct caio_proxy *p) {
+    if (p == NULL) {
+        return -1;
+    }
+
+    _flow_deinit(&p->flows[0]);
+    _flow_deinit(&p->flows[1]);
+    return 0;
+}
+
+
+/* Half close on EOF, otherwise stop the other flow too */
+static void
+_flow_finish(struct caio_proxy_flow *f) {
+    struct caio_proxy *p = f->proxy;
+
+    if (f->eof && (f->pending == 0)) {
+        shutdown(f->out, SHUT_WR);
+    }
+    else {
+        shutdown(f->in, SHUT_RDWR);
+        shutdown(f->out, SHUT_RDWR);
+    }
+
+    if ((--p->running == 0) && p->done) {
+        p->done(p);
+    }
+}
+
+
+/* Mirror the fresh data of the pipe, without consuming it */
+static void
+_flow_tap(struct caio_proxy_flow *f, size_t len) {
+    ssize_t ret;
+
+    if (f->tap == -1) {
+        return;
+    }
+
+    ret = tee(f->pipe[0], f->tap, len, SPLICE_F_NONBLOCK);
+    if (ret < 0) {
+        ret = 0;
+    }
+
+    f->tapped += ret;
+    f->tapdropped += len - ret;
+}
+
+
+ASYNC
+caio_proxy_flowA(struct caio_task *self, struct caio_proxy_flow *f,
+        struct caio_fdmon *fdmon) {
+    ssize_t ret;
+    CAIO_BEGIN(self);
+
+    while (!f->eof || f->pending) {
+        /* The pipe is empty, so EAGAIN is about the socket */
+        if (f->pending == 0) {
+            ret = splice(f->in, NULL, f->pipe[1], NULL, f->chunk,
+                    SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if ((ret == -1) && CAIO_MUSTWAIT(errno)) {
+                CAIO_FILE_AWAIT(fdmon, self, f->in, CAIO_IN);
+                continue;
+            }
+
+            if (ret == -1) {
+                CAIO_THROW(self, errno);
+            }
+
+            if (ret == 0) {
+                f->eof = true;
+                continue;
+            }
+
+            f->pending = ret;
+            _flow_tap(f, ret);
+        }
+
+        ret = splice(f->pipe[0], NULL, f->out, NULL, f->pending,
+                SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if ((ret == -1) && CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(fdmon, self, f->out, CAIO_OUT);
+            continue;
+        }
+
+        if (ret == -1) {
+            CAIO_THROW(self, errno);
+        }
+
+        f->pending -= ret;
+        f->total += ret;
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(fdmon, f->in);
+    CAIO_FILE_FORGET(fdmon, f->out);
+    _flow_finish(f);
+}
+
+
+int
+caio_proxy_spawn(struct caio *c, struct caio_proxy *p,
+        struct caio_fdmon *fdmon) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (caio_proxy_flow_spawn(c, caio_proxy_flowA, &p->flows[i],
+                    fdmon)) {
+            goto failed;
+        }
+        p->running++;
+    }
+
+    return 0;
+
+failed:
+    /* Let the spawned flow end */
+    shutdown(p->flows[0].in, SHUT_RDWR);
+    shutdown(p->flows[1].in, SHUT_RDWR);
+    return -1;
+}
+
+
+#ifdef CONFIG_CAIO_URING
+
+
+#define _TEE(f) ((f)->pending && (f)->fresh && ((f)->tap != -1))
+
+
+/* Results of the chain submitted by caio_proxy_flow_uringA(), the flow
+ * did not change since, so the chain is rebuilt the same way. */
+static int
+_uring_round(struct caio_task *self, struct caio_proxy_flow *f) {
+    struct io_uring_cqe *cqe;
+    unsigned int position = 0;
+    int res;
+
+    if (_TEE(f)) {
+        cqe = caio_uring_chain_cqe(self, position++);
+        res = (cqe && (cqe->res > 0))? cqe->res: 0;
+        f->tapped += res;
+        f->tapdropped += f->pending - res;
+    }
+    f->fresh = false;
+
+    if (f->pending) {
+        /* poll */
+        cqe = caio_uring_chain_cqe(self, position++);
+        if ((cqe == NULL) || (cqe->res < 0)) {
+            return cqe? -cqe->res: EIO;
+        }
+
+        /* splice out */
+        cqe = caio_uring_chain_cqe(self, position++);
+        res = cqe? cqe->res: -EIO;
+        if ((res < 0) && (res != -EAGAIN)) {
+            return -res;
+        }
+
+        if (res > 0) {
+            f->pending -= res;
+            f->total += res;
+        }
+    }
+
+    if (f->eof) {
+        return 0;
+    }
+
+    /* poll, cancelled by a short splice out */
+    cqe = caio_uring_chain_cqe(self, position++);
+    res = cqe? cqe->res: -EIO;
+    if (res == -ECANCELED) {
+        return 0;
+    }
+
+    if (res < 0) {
+        return -res;
+    }
+
+    /* splice in */
+    cqe = caio_uring_chain_cqe(self, position++);
+    res = cqe? cqe->res: -EIO;
+    if ((res == -ECANCELED) || (res == -EAGAIN)) {
+        return 0;
+    }
+
+    if (res < 0) {
+        return -res;
+    }
+
+    if (res == 0) {
+        f->eof = true;
+        return 0;
+    }
+
+    f->pending += res;
+    f->fresh = true;
+    return 0;
+}
+
+
+static int
+_uring_submit(struct caio_uring *u, struct caio_task *self,
+        struct caio_proxy_flow *f) {
+    struct caio_uring_chain chain;
+    struct io_uring_sqe *sqe;
+    unsigned int length;
+
+    length = _TEE(f) + (f->pending? 2: 0) + (f->eof? 0: 2);
+    if (caio_uring_chain_begin(&chain, u, self, length)) {
+        return -1;
+    }
+
+    /* The tap is full, keep going */
+    if (_TEE(f)) {
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_tee(sqe, f->pipe[0], f->tap, f->pending,
+                SPLICE_F_NONBLOCK);
+    }
+
+    if (f->pending) {
+        sqe = caio_uring_chain_sqe_get(&chain, true);
+        caio_uring_prep_poll_add(sqe, f->out, POLLOUT);
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_splice(sqe, f->pipe[0], -1, f->out, -1, f->pending,
+                SPLICE_F_MOVE);
+    }
+
+    /* Only when the pipe is drained, a short splice out cancels these */
+    if (!f->eof) {
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_poll_add(sqe, f->in, POLLIN);
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_splice(sqe, f->in, -1, f->pipe[1], -1, f->chunk,
+                SPLICE_F_MOVE);
+    }
+
+    return (caio_uring_chain_submit(&chain) < 0)? -1: (int)length;
+}
+
+
+ASYNC
+caio_proxy_flow_uringA(struct caio_task *self, struct caio_proxy_flow *f,
+        struct caio_uring *u) {
+    int ret;
+    CAIO_BEGIN(self);
+
+    while (!f->eof || f->pending) {
+        ret = _uring_submit(u, self, f);
+        if (ret < 0) {
+            CAIO_THROW(self, errno);
+        }
+
+        CAIO_URING_AWAIT(u, self, ret);
+        ret = _uring_round(self, f);
+        caio_uring_chain_seen(u, self);
+        if (ret) {
+            CAIO_THROW(self, ret);
+        }
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(u, self);
+    _flow_finish(f);
+}
+
+
+int
+caio_proxy_uring_spawn(struct caio *c, struct caio_proxy *p,
+        struct caio_uring *u) {
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        if (caio_proxy_flow_uring_spawn(c, caio_proxy_flow_uringA,
+                    &p->flows[i], u)) {
+            goto failed;
+        }
+        p->running++;
+    }
+
+    return 0;
+
+failed:
+    shutdown(p->flows[0].in, SHUT_RDWR);
+    shutdown(p->flows[1].in, SHUT_RDWR);
+    return -1;
+}
+
+
+#endif  // CONFIG_CAIO_URING
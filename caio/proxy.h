@@ -0,0 +1,144 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_PROXY_H_
+#define CAIO_PROXY_H_
+
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+
+
+/* Zero-copy bidirectional proxy between two connected sockets. The data
+ * moves socket -> pipe -> socket with splice(2), so it never reaches the
+ * user-space. Each direction is a flow, driven by its own task:
+ *
+ *   caio_proxy_create(&p, client, upstream, 0);
+ *   caio_proxy_spawn(c, &p, fdmon);
+ *
+ * A flow shuts down the write side of its output on EOF, and both sockets
+ * entirely on errors, so the other flow ends too. The done callback is
+ * called when both flows are finished, the sockets are still open then.
+ *
+ * Splicing into a closed socket raises SIGPIPE, ignore it. */
+struct caio_proxy;
+typedef void (*caio_proxy_done) (struct caio_proxy *p);
+
+
+typedef struct caio_proxy_flow {
+    int in;
+    int out;
+
+    /* Optional write end of a pipe(2), the data is mirrored there with
+     * tee(2) on the way, -1 means no tap. The proxy never waits for the
+     * tap, the data which does not fit is dropped. */
+    int tap;
+
+    /* bytes moved, mirrored and dropped by the tap */
+    size_t total;
+    size_t tapped;
+    size_t tapdropped;
+
+    /* private */
+    struct caio_proxy *proxy;
+    int pipe[2];
+    size_t chunk;
+    size_t pending;
+    bool fresh;
+    bool eof;
+} caio_proxy_flow_t;
+
+
+typedef struct caio_proxy {
+    /* flows[0] moves a to b and flows[1] b to a */
+    struct caio_proxy_flow flows[2];
+    caio_proxy_done done;
+    void *userdata;
+
+    /* private */
+    unsigned int running;
+} caio_proxy_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_proxy_flow
+#define CAIO_ARG1 struct caio_fdmon *
+#include "caio/generic.h"
+
+
+/* chunk is the maximum bytes per splice, zero means the pipe size. The
+ * output of each flow is a dup(2) of the other socket, so the flows never
+ * share a descriptor in the fdmon. */
+int
+caio_proxy_create(struct caio_proxy *p, int a, int b, size_t chunk);
+
+
+/* Closes the pipes and the duplicated descriptors, not a and b */
+int
+caio_proxy_destroy(struct caio_proxy *p);
+
+
+/* Spawns a task per flow, the sockets must be non-blocking */
+int
+caio_proxy_spawn(struct caio *c, struct caio_proxy *p,
+        struct caio_fdmon *fdmon);
+
+
+ASYNC
+caio_proxy_flowA(struct caio_task *self, struct caio_proxy_flow *f,
+        struct caio_fdmon *fdmon);
+
+
+#ifdef CONFIG_CAIO_URING
+
+#include "caio/uring.h"
+
+
+typedef struct caio_proxy_flow caio_proxy_flow_uring_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_proxy_flow_uring
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.h"  // NOLINT
+
+
+/* Same as caio_proxy_spawn(), each round of a flow is one linked chain:
+ * tee -> poll -> splice out -> poll -> splice in. A short splice out
+ * cancels the rest of the chain, so the pipe is empty whenever new data
+ * arrives. */
+int
+caio_proxy_uring_spawn(struct caio *c, struct caio_proxy *p,
+        struct caio_uring *u);
+
+
+ASYNC
+caio_proxy_flow_uringA(struct caio_task *self, struct caio_proxy_flow *f,
+        struct caio_uring *u);
+
+#endif  // CONFIG_CAIO_URING
+
+
+#endif  // CAIO_PROXY_H_
@@ -0,0 +1,295 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+
+#include "caio/caio.h"
+#include "caio/shard.h"
+
+
+struct caio_shards {
+    struct caio_shard_config config;
+    unsigned int count;
+    unsigned int started;
+    atomic_bool terminating;
+    struct caio_shard shards[];
+};
+
+
+int
+caio_shard_listen(const struct sockaddr *addr, socklen_t addrlen,
+        int backlog) {
+    int fd;
+    int option = 1;
+
+    fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    /* Each loop binds the same address, the kernel distributes the incoming
+     * connections between them */
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &option, sizeof(option))) {
+        goto failed;
+    }
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option))) {
+        goto failed;
+    }
+
+    if (bind(fd, addr, addrlen)) {
+        goto failed;
+    }
+
+    if (listen(fd, backlog)) {
+        goto failed;
+    }
+
+    return fd;
+
+failed:
+    close(fd);
+    return -1;
+}
+
+
+/* Runs on the shard's thread, so the task pool is only touched by its own
+ * loop */
+static int
+_stop_tick(struct caio *c, struct caio_shard *shard, unsigned int timeout_us) {
+    if (shard->killed || (!atomic_load(&shard->group->terminating))) {
+        return 0;
+    }
+
+    shard->killed = true;
+    caio_task_killall(c);
+    return 0;
+}
+
+
+static void *
+_shard_main(void *arg) {
+    struct caio_shard *shard = arg;
+    struct caio_shards *s = shard->group;
+    struct caio_shard_config *config = &s->config;
+    cpu_set_t cpus;
+
+    shard->status = -1;
+
+    if (shard->cpu >= 0) {
+        CPU_ZERO(&cpus);
+        CPU_SET(shard->cpu, &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus)) {
+            return NULL;
+        }
+    }
+
+    shard->caio = caio_create(config->maxtasks);
+    if (shard->caio == NULL) {
+        return NULL;
+    }
+
+    if (config->bindaddr) {
+        shard->listenfd = caio_shard_listen(config->bindaddr,
+                config->bindaddrlen, config->backlog);
+        if (shard->listenfd == -1) {
+            goto terminate;
+        }
+    }
+
+    shard->module.tick = (caio_tick) _stop_tick;
+    if (caio_module_install(shard->caio, &shard->module)) {
+        goto terminate;
+    }
+
+    if (config->setup && config->setup(shard)) {
+        goto terminate;
+    }
+
+    shard->status = caio_loop(shard->caio);
+
+    if (config->teardown && config->teardown(shard)) {
+        shard->status = -1;
+    }
+
+terminate:
+    if (shard->listenfd != -1) {
+        close(shard->listenfd);
+        shard->listenfd = -1;
+    }
+
+    /* Destroyed by caio_shards_join(), caio_shards_killall() may still
+     * look at it */
+    return NULL;
+}
+
+
+struct caio_shards *
+caio_shards_create(const struct caio_shard_config *config) {
+    struct caio_shards *s;
+    unsigned int i;
+    unsigned int count;
+    long cpus;
+
+    if ((config == NULL) || (config->maxtasks == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) {
+        cpus = 1;
+    }
+
+    count = config->count;
+    if (count == 0) {
+        count = cpus;
+    }
+
+    s = malloc(sizeof(struct caio_shards) +
+            sizeof(struct caio_shard) * count);
+    if (s == NULL) {
+        return NULL;
+    }
+    memset(s, 0, sizeof(struct caio_shards) +
+            sizeof(struct caio_shard) * count);
+
+    s->config = *config;
+    s->count = count;
+    s->started = 0;
+
+    for (i = 0; i < count; i++) {
+        s->shards[i].index = i;
+        s->shards[i].group = s;
+        s->shards[i].userdata = config->userdata;
+        s->shards[i].listenfd = -1;
+        s->shards[i].cpu = (config->flags & CAIO_SHARD_PINCPU)? i % cpus: -1;
+    }
+
+    return s;
+}
+
+
+int
+caio_shards_destroy(struct caio_shards *s) {
+    if (s == NULL) {
+        return -1;
+    }
+
+    if (s->started) {
+        return -1;
+    }
+
+    free(s);
+    return 0;
+}
+
+
+int
+caio_shards_start(struct caio_shards *s) {
+    unsigned int i;
+    struct caio_shard *shard;
+    sigset_t all;
+    sigset_t old;
+
+    if ((s == NULL) || s->started) {
+        return -1;
+    }
+
+    /* Signals are delivered to the calling thread only, loop threads inherit
+     * a fully blocked mask */
+    sigfillset(&all);
+    if (pthread_sigmask(SIG_SETMASK, &all, &old)) {
+        return -1;
+    }
+
+    for (i = 0; i < s->count; i++) {
+        shard = &s->shards[i];
+        if (pthread_create(&shard->thread, NULL, _shard_main, shard)) {
+            break;
+        }
+        s->started++;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (s->started < s->count) {
+        caio_shards_killall(s);
+        caio_shards_join(s);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+caio_shards_join(struct caio_shards *s) {
+    unsigned int i;
+    struct caio_shard *shard;
+    int ret = 0;
+
+    if (s == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < s->started; i++) {
+        shard = &s->shards[i];
+        if (pthread_join(shard->thread, NULL)) {
+            ret = -1;
+            continue;
+        }
+
+        ret |= shard->status;
+        caio_destroy(shard->caio);
+        shard->caio = NULL;
+        shard->killed = false;
+    }
+
+    s->started = 0;
+    atomic_store(&s->terminating, false);
+    return ret;
+}
+
+
+void
+caio_shards_killall(struct caio_shards *s) {
+    atomic_store(&s->terminating, true);
+}
+
+
+unsigned int
+caio_shards_count(struct caio_shards *s) {
+    return s->count;
+}
+
+
+struct caio_shard *
+caio_shards_get(struct caio_shards *s, unsigned int index) {
+    if (index >= s->count) {
+        return NULL;
+    }
+
+    return &s->shards[index];
+}
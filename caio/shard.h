@@ -0,0 +1,132 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_SHARD_H_
+#define CAIO_SHARD_H_
+
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include "caio/caio.h"
+
+
+/* Runs N independent caio loops, one per thread. Each loop owns its own
+ * struct caio, its own IO module(s) (created by the setup hook) and its own
+ * SO_REUSEPORT listening socket, so the kernel balances the incoming
+ * connections between loops without any shared state.
+ *
+ * Each loop is stopped by a module of its own, which watches the stop flag
+ * of the group and kills the loop's tasks on the loop's own thread, see
+ * caio_shards_killall().
+ */
+struct caio_shards;
+struct caio_shard;
+typedef int (*caio_shard_hook) (struct caio_shard *shard);
+
+
+enum caio_shard_flags {
+    /* Pin each loop's thread to CPU: index % online CPUs */
+    CAIO_SHARD_PINCPU = 1,
+};
+
+
+struct caio_shard {
+    /* private, the stop module of the loop */
+    struct caio_module module;
+    bool killed;
+
+    unsigned int index;
+    int cpu;
+    pthread_t thread;
+
+    /* valid until caio_shards_join() */
+    struct caio *caio;
+    int listenfd;
+    int status;
+    struct caio_shards *group;
+
+    /* shared pointer from caio_shard_config.userdata */
+    void *userdata;
+
+    /* per-shard pointer, owned by setup/teardown hooks */
+    void *state;
+};
+
+
+struct caio_shard_config {
+    /* number of loops, zero means one per online CPU */
+    unsigned int count;
+
+    /* maximum tasks per loop */
+    size_t maxtasks;
+
+    const struct sockaddr *bindaddr;
+    socklen_t bindaddrlen;
+    int backlog;
+    int flags;
+
+    /* called inside the shard's thread after the loop and the listening
+     * socket are created, must create the IO module(s) and spawn the initial
+     * task(s). */
+    caio_shard_hook setup;
+
+    /* called inside the shard's thread after the loop is finished. */
+    caio_shard_hook teardown;
+    void *userdata;
+};
+
+
+int
+caio_shard_listen(const struct sockaddr *addr, socklen_t addrlen,
+        int backlog);
+
+
+struct caio_shards *
+caio_shards_create(const struct caio_shard_config *config);
+
+
+int
+caio_shards_destroy(struct caio_shards *s);
+
+
+int
+caio_shards_start(struct caio_shards *s);
+
+
+int
+caio_shards_join(struct caio_shards *s);
+
+
+/* Asks all the loops to kill their tasks, only sets an atomic flag, so it
+ * is async-signal-safe and may be called from any thread. Each loop notices
+ * it in its next tick. */
+void
+caio_shards_killall(struct caio_shards *s);
+
+
+unsigned int
+caio_shards_count(struct caio_shards *s);
+
+
+struct caio_shard *
+caio_shards_get(struct caio_shards *s, unsigned int index);
+
+
+#endif  // CAIO_SHARD_H_
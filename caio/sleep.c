@@ -64,7 +64,8 @@ _settimeout(int fd, time_t miliseconds) {
         return -1;
     }
 
-    struct timespec sec = {miliseconds / 1000, (miliseconds % 1000) * 1000};
+    struct timespec sec = {miliseconds / 1000,
+        (miliseconds % 1000) * 1000000};
     struct timespec zero = {0, 0};
     struct itimerspec spec = {zero, sec};
     if (timerfd_settime(fd, 0, &spec, NULL) == -1) {
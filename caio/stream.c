@@ -0,0 +1,450 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "caio/caio.h"
+#include "caio/stream.h"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_stream
+#define CAIO_ARG1 void *
+#define CAIO_ARG2 size_t
+#include "caio/generic.c"
+
+
+#define RING_FREE(r) ((r)->size - (r)->len)
+#define RING_AT(r, i) ((r)->buff[((r)->head + (i)) % (r)->size])
+
+
+/* Data segments of the ring, returns the number of iovecs used */
+static int
+_ring_datav(struct caio_stream_ring *r, struct iovec *v) {
+    size_t first;
+
+    if (r->len == 0) {
+        return 0;
+    }
+
+    first = r->size - r->head;
+    if (first >= r->len) {
+        v[0].iov_base = r->buff + r->head;
+        v[0].iov_len = r->len;
+        return 1;
+    }
+
+    v[0].iov_base = r->buff + r->head;
+    v[0].iov_len = first;
+    v[1].iov_base = r->buff;
+    v[1].iov_len = r->len - first;
+    return 2;
+}
+
+
+/* Free segments of the ring, returns the number of iovecs used */
+static int
+_ring_freev(struct caio_stream_ring *r, struct iovec *v) {
+    size_t tail;
+    size_t avail = RING_FREE(r);
+
+    if (avail == 0) {
+        return 0;
+    }
+
+    tail = (r->head + r->len) % r->size;
+    if (tail + avail <= r->size) {
+        v[0].iov_base = r->buff + tail;
+        v[0].iov_len = avail;
+        return 1;
+    }
+
+    v[0].iov_base = r->buff + tail;
+    v[0].iov_len = r->size - tail;
+    v[1].iov_base = r->buff;
+    v[1].iov_len = avail - v[0].iov_len;
+    return 2;
+}
+
+
+static size_t
+_ring_copyout(struct caio_stream_ring *r, char *buff, size_t len) {
+    struct iovec v[2];
+    size_t copied = 0;
+    size_t chunk;
+    int i;
+    int count;
+
+    count = _ring_datav(r, v);
+    for (i = 0; (i < count) && (copied < len); i++) {
+        chunk = v[i].iov_len;
+        if (chunk > (len - copied)) {
+            chunk = len - copied;
+        }
+
+        if (buff) {
+            memcpy(buff + copied, v[i].iov_base, chunk);
+        }
+        copied += chunk;
+    }
+
+    return copied;
+}
+
+
+static void
+_ring_skip(struct caio_stream_ring *r, size_t len) {
+    r->len -= len;
+    r->head = r->len? (r->head + len) % r->size: 0;
+}
+
+
+static size_t
+_ring_put(struct caio_stream_ring *r, const char *buff, size_t len) {
+    struct iovec v[2];
+    size_t copied = 0;
+    size_t chunk;
+    int i;
+    int count;
+
+    count = _ring_freev(r, v);
+    for (i = 0; (i < count) && (copied < len); i++) {
+        chunk = v[i].iov_len;
+        if (chunk > (len - copied)) {
+            chunk = len - copied;
+        }
+
+        memcpy(v[i].iov_base, buff + copied, chunk);
+        copied += chunk;
+    }
+
+    r->len += copied;
+    return copied;
+}
+
+
+/* Reads as much as available with one syscall, directly into dst first
+ * (if given) and the rest into the input ring. Returns the bytes stored in
+ * dst via *direct. */
+static ssize_t
+_fill(struct caio_stream *s, char *dst, size_t dstlen, size_t *direct) {
+    struct iovec v[3];
+    int count = 0;
+    ssize_t bytes;
+
+    *direct = 0;
+    if (dst && dstlen) {
+        v[0].iov_base = dst;
+        v[0].iov_len = dstlen;
+        count++;
+    }
+    count += _ring_freev(&s->in, v + count);
+    if (count == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    bytes = readv(s->fd, v, count);
+    if (bytes <= 0) {
+        return bytes;
+    }
+
+    if (dst && dstlen) {
+        *direct = ((size_t)bytes > dstlen)? dstlen: bytes;
+    }
+    s->in.len += bytes - *direct;
+    return bytes;
+}
+
+
+/* Writes the output ring followed by src (if given) with one syscall.
+ * Returns the bytes taken from src via *direct. */
+static ssize_t
+_drain(struct caio_stream *s, const char *src, size_t srclen,
+        size_t *direct) {
+    struct iovec v[3];
+    int count;
+    ssize_t bytes;
+    size_t fromring;
+
+    *direct = 0;
+    count = _ring_datav(&s->out, v);
+    if (src && srclen) {
+        v[count].iov_base = (void *)src;
+        v[count].iov_len = srclen;
+        count++;
+    }
+
+    if (count == 0) {
+        return 0;
+    }
+
+    bytes = writev(s->fd, v, count);
+    if (bytes <= 0) {
+        return bytes;
+    }
+
+    fromring = ((size_t)bytes > s->out.len)? s->out.len: bytes;
+    _ring_skip(&s->out, fromring);
+    *direct = bytes - fromring;
+    return bytes;
+}
+
+
+static ssize_t
+_find(struct caio_stream_ring *r, size_t from, const char *delim,
+        size_t delimlen) {
+    size_t i;
+    size_t j;
+
+    for (i = from; (i + delimlen) <= r->len; i++) {
+        for (j = 0; j < delimlen; j++) {
+            if (RING_AT(r, i + j) != delim[j]) {
+                break;
+            }
+        }
+
+        if (j == delimlen) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+
+int
+caio_stream_create(struct caio_stream *s, int fd, struct caio_fdmon *fdmon,
+        size_t insize, size_t outsize) {
+    if ((s == NULL) || (insize == 0) || (outsize == 0)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(s, 0, sizeof(struct caio_stream));
+    s->in.buff = malloc(insize);
+    if (s->in.buff == NULL) {
+        return -1;
+    }
+
+    s->out.buff = malloc(outsize);
+    if (s->out.buff == NULL) {
+        free(s->in.buff);
+        s->in.buff = NULL;
+        return -1;
+    }
+
+    s->fd = fd;
+    s->fdmon = fdmon;
+    s->in.size = insize;
+    s->out.size = outsize;
+    return 0;
+}
+
+
+int
+caio_stream_destroy(struct caio_stream *s) {
+    if (s == NULL) {
+        return -1;
+    }
+
+    free(s->in.buff);
+    free(s->out.buff);
+    s->in.buff = NULL;
+    s->out.buff = NULL;
+    return 0;
+}
+
+
+size_t
+caio_stream_available(struct caio_stream *s) {
+    return s->in.len;
+}
+
+
+size_t
+caio_stream_peek(struct caio_stream *s, void *buff, size_t len) {
+    return _ring_copyout(&s->in, buff, len);
+}
+
+
+size_t
+caio_stream_consume(struct caio_stream *s, void *buff, size_t len) {
+    size_t copied = _ring_copyout(&s->in, buff, len);
+
+    _ring_skip(&s->in, copied);
+    return copied;
+}
+
+
+size_t
+caio_stream_pending(struct caio_stream *s) {
+    return s->out.len;
+}
+
+
+ASYNC
+caio_stream_readA(struct caio_task *self, struct caio_stream *s, void *buff,
+        size_t len) {
+    ssize_t bytes;
+    size_t direct;
+    CAIO_BEGIN(self);
+
+    s->rpos = caio_stream_consume(s, buff, len);
+    while (s->rpos < len) {
+        /* Input ring is empty here, big reads go straight to the caller's
+         * buffer and the surplus goes to the ring */
+        bytes = _fill(s, (char *)buff + s->rpos, len - s->rpos, &direct);
+        if (bytes > 0) {
+            s->rpos += direct;
+            s->rpos += caio_stream_consume(s, (char *)buff + s->rpos,
+                    len - s->rpos);
+            continue;
+        }
+
+        if (bytes == 0) {
+            s->eof = true;
+            CAIO_THROW(self, ENODATA);
+        }
+
+        if (CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(s->fdmon, self, s->fd, CAIO_IN);
+            continue;
+        }
+
+        CAIO_THROW(self, errno);
+    }
+
+    CAIO_FINALLY(self);
+}
+
+
+ASYNC
+caio_stream_readuntilA(struct caio_task *self, struct caio_stream *s,
+        void *delim, size_t delimlen) {
+    ssize_t bytes;
+    ssize_t index;
+    size_t direct;
+    CAIO_BEGIN(self);
+
+    if (delimlen == 0) {
+        CAIO_THROW(self, EINVAL);
+    }
+
+    /* rpos is where the search continues after each fill */
+    s->rpos = 0;
+    while (true) {
+        index = _find(&s->in, s->rpos, delim, delimlen);
+        if (index >= 0) {
+            s->found = index + delimlen;
+            break;
+        }
+
+        if (s->in.len >= delimlen) {
+            s->rpos = s->in.len - delimlen + 1;
+        }
+
+        if (RING_FREE(&s->in) == 0) {
+            CAIO_THROW(self, ENOBUFS);
+        }
+
+        bytes = _fill(s, NULL, 0, &direct);
+        if (bytes > 0) {
+            continue;
+        }
+
+        if (bytes == 0) {
+            s->eof = true;
+            CAIO_THROW(self, ENODATA);
+        }
+
+        if (CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(s->fdmon, self, s->fd, CAIO_IN);
+            continue;
+        }
+
+        CAIO_THROW(self, errno);
+    }
+
+    CAIO_FINALLY(self);
+}
+
+
+ASYNC
+caio_stream_writeA(struct caio_task *self, struct caio_stream *s, void *buff,
+        size_t len) {
+    ssize_t bytes;
+    size_t direct;
+    CAIO_BEGIN(self);
+
+    s->wpos = 0;
+    while (true) {
+        /* Fits, no syscall */
+        if ((len - s->wpos) <= RING_FREE(&s->out)) {
+            _ring_put(&s->out, (char *)buff + s->wpos, len - s->wpos);
+            break;
+        }
+
+        /* Gather the buffered data and the new data into one writev(2) */
+        bytes = _drain(s, (char *)buff + s->wpos, len - s->wpos, &direct);
+        if (bytes >= 0) {
+            s->wpos += direct;
+            continue;
+        }
+
+        if (CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(s->fdmon, self, s->fd, CAIO_OUT);
+            continue;
+        }
+
+        CAIO_THROW(self, errno);
+    }
+
+    CAIO_FINALLY(self);
+}
+
+
+ASYNC
+caio_stream_flushA(struct caio_task *self, struct caio_stream *s,
+        void *unused, size_t unusedlen) {
+    ssize_t bytes;
+    size_t direct;
+    CAIO_BEGIN(self);
+
+    while (s->out.len) {
+        bytes = _drain(s, NULL, 0, &direct);
+        if (bytes >= 0) {
+            continue;
+        }
+
+        if (CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(s->fdmon, self, s->fd, CAIO_OUT);
+            continue;
+        }
+
+        CAIO_THROW(self, errno);
+    }
+
+    CAIO_FINALLY(self);
+}
@@ -0,0 +1,150 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ */
+#ifndef CAIO_STREAM_H_
+#define CAIO_STREAM_H_
+
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+
+
+/* Buffered non-blocking file/socket stream.
+ *
+ * The input side is a ring buffer filled by readv(2), each syscall reads as
+ * much as available. The output side is a ring buffer too, small writes are
+ * queued there and sent together using writev(2) on flush, or when the
+ * buffer is full.
+ *
+ * One reader and one writer at a time. The await points use the given
+ * caio_fdmon, so any fdmon backend works.
+ *
+ * Hitting EOF before a read is satisfied terminates the caller with
+ * ENODATA and sets eof, other errors are rethrown as is.
+ */
+struct caio_stream_ring {
+    char *buff;
+    size_t size;
+    size_t head;
+    size_t len;
+};
+
+
+typedef struct caio_stream {
+    int fd;
+    struct caio_fdmon *fdmon;
+    bool eof;
+
+    /* length of the data including the delimiter found by the last
+     * CAIO_STREAM_READUNTIL */
+    size_t found;
+
+    /* private */
+    struct caio_stream_ring in;
+    struct caio_stream_ring out;
+    size_t rpos;
+    size_t wpos;
+} caio_stream_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_stream
+#define CAIO_ARG1 void *
+#define CAIO_ARG2 size_t
+#include "caio/generic.h"
+
+
+int
+caio_stream_create(struct caio_stream *s, int fd, struct caio_fdmon *fdmon,
+        size_t insize, size_t outsize);
+
+
+int
+caio_stream_destroy(struct caio_stream *s);
+
+
+/* buffered input, no IO */
+size_t
+caio_stream_available(struct caio_stream *s);
+
+
+size_t
+caio_stream_peek(struct caio_stream *s, void *buff, size_t len);
+
+
+/* copy and remove up to len bytes from the input buffer, buff may be NULL
+ * to just discard them */
+size_t
+caio_stream_consume(struct caio_stream *s, void *buff, size_t len);
+
+
+/* buffered output, no IO */
+size_t
+caio_stream_pending(struct caio_stream *s);
+
+
+ASYNC
+caio_stream_readA(struct caio_task *self, struct caio_stream *s, void *buff,
+        size_t len);
+
+
+ASYNC
+caio_stream_readuntilA(struct caio_task *self, struct caio_stream *s,
+        void *delim, size_t delimlen);
+
+
+ASYNC
+caio_stream_writeA(struct caio_task *self, struct caio_stream *s, void *buff,
+        size_t len);
+
+
+ASYNC
+caio_stream_flushA(struct caio_task *self, struct caio_stream *s,
+        void *unused, size_t unusedlen);
+
+
+/* Read exactly len bytes into buff */
+#define CAIO_STREAM_READ(task, stream, buff, len) \
+    CAIO_AWAIT(task, caio_stream, caio_stream_readA, stream, buff, len)
+
+
+/* Wait until the delimiter is buffered, stream->found holds the length of
+ * the data including the delimiter, use caio_stream_consume() to take it.
+ * Terminates with ENOBUFS if the input buffer is full before that. */
+#define CAIO_STREAM_READUNTIL(task, stream, delim, delimlen) \
+    CAIO_AWAIT(task, caio_stream, caio_stream_readuntilA, stream, \
+            (void *)(delim), delimlen)
+
+
+/* Accept all the bytes, either into the output buffer or into the kernel */
+#define CAIO_STREAM_WRITE(task, stream, buff, len) \
+    CAIO_AWAIT(task, caio_stream, caio_stream_writeA, stream, \
+            (void *)(buff), len)
+
+
+/* Send the whole output buffer */
+#define CAIO_STREAM_FLUSH(task, stream) \
+    CAIO_AWAIT(task, caio_stream, caio_stream_flushA, stream, NULL, 0)
+
+
+#endif  // CAIO_STREAM_H_
@@ -17,320 +17,2094 @@
  *  Author: Vahid Mardani <vahid.mardani@gmail.com>
  */
 #include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
 
+#include "caio/fdmon.h"
 #include "caio/uring.h"
 
 
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_uring_message
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.c"  // NOLINT
+
+
+/* Messages of the other rings are not jobs, their user_data is the payload
+ * tagged with these */
+#define _MESSAGE (1ULL << 63)
+#define _MESSAGEFD (1ULL << 62)
+
+
+/* caio_fdmon on top of the ring, see caio_uring_fdmon() */
+struct caio_uring_fdmon {
+    struct caio_fdmon;
+    struct caio_uring *uring;
+};
+
+
 struct caio_uring {
     struct caio_module;
     struct io_uring ring;
 
     sigset_t *sigmask;
     unsigned int jobsmax;
+    int flags;
 
     unsigned int jobstotal;
     unsigned int jobswaiting;
+
+    /* SQEs taken since the last submit */
+    unsigned int queued;
+
+    /* orphaned jobs still waiting for a free SQE to be cancelled, and
+     * multishot jobs to be rearmed */
+    unsigned int cancelpending;
+    unsigned int rearmpending;
+    struct caio_uring_stats stats;
+
+    /* Preallocated task states, one per job at most */
+    struct caio_uring_taskstate *states;
+    struct caio_uring_taskstate *freestates;
+
+    /* Registered buffers, one contiguous block, free indexes are kept in a
+     * stack */
+    char *buffers;
+    size_t buffersize;
+    unsigned int bufferscount;
+    int *bufferfree;
+    unsigned int bufferfreecount;
+    unsigned char *bufferleased;
+
+    /* Preallocated jobs, one per in-flight SQE */
+    struct caio_uring_job *jobs;
+    struct caio_uring_job *freejobs;
+
+    /* Zero-copy sends waiting for the notification */
+    size_t zcthreshold;
+    unsigned int zcpending;
+
+    /* Readiness polls armed by the fdmon interface */
+    struct caio_uring_fdmon fdmon;
+    unsigned int polls;
+
+    /* Messages posted by the other rings, a circular queue */
+    struct caio_uring_message *inbox;
+    unsigned int inboxsize;
+    unsigned int inboxhead;
+    unsigned int inboxcount;
+    struct caio_task *receiver;
+
+    /* CAIO_URING_HUGEPAGES: the rings and the SQEs */
+    void *ringmem;
+    size_t ringmemsize;
+
+    /* CAIO_URING_EVENTFD */
+    int eventfd;
+};
+
+
+/* The user_data of every SQE points to one of these, so a CQE never
+ * touches a task which is already gone. A zero-copy send outlives its
+ * task state until the notification arrives. */
+struct caio_uring_job {
+    struct caio_uring *uring;
+    struct caio_uring_taskstate *ustate;
+    __u64 tags;
+    struct caio_uring_job *next;
+    bool busy;
+
+    /* a cancel request is queued for the orphaned job */
+    bool cancelled;
+
+    /* terminated multishot job waiting for a free SQE to be rearmed */
+    bool rearmpending;
+
+    /* zero-copy send */
+    const void *buf;
+    caio_uring_release release;
+    void *ptr;
+
+    /* fdmon poll, the task is NULL when the file is forgotten */
+    int fd;
+    struct caio_task *task;
+    struct __kernel_timespec timeout;
+};
+
+
+/* Provided buffer ring, the kernel picks a buffer when data arrives and
+ * reports its id in the CQE flags */
+struct caio_uring_bufring {
+    struct caio_uring *uring;
+    struct io_uring_buf_ring *br;
+    char *buffers;
+    size_t size;
+    unsigned int count;
+    int mask;
+    int bgid;
 };
 
 
+/* CQEs are copied here, so the completion queue is advanced once per tick,
+ * the user_data of a seen CQE is zeroed. */
 struct caio_uring_taskstate {
+    struct caio_uring *uring;
+
+    /* NULL when the task is terminated with in-flight jobs, the state is
+     * released when the last one completes */
+    struct caio_task *task;
     volatile unsigned int waiting;
     volatile unsigned int completed;
-    struct io_uring_cqe *cqes[CONFIG_CAIO_URING_TASK_MAXWAITING];
+    unsigned int seen;
+
+    /* multishot jobs among the waiting ones */
+    unsigned int armed;
+
+    /* copy of the automatically rearmed multishot SQE, if any */
+    struct io_uring_sqe rearm;
+    struct caio_uring_taskstate *next;
+    struct io_uring_cqe cqes[CONFIG_CAIO_URING_TASK_MAXWAITING];
 };
 
 
+static struct caio_uring_taskstate *
+_taskstate_get(struct caio_uring *u, struct caio_task *task) {
+    struct caio_uring_taskstate *ustate = u->freestates;
+
+    if (ustate == NULL) {
+        return NULL;
+    }
+
+    u->freestates = ustate->next;
+    ustate->next = NULL;
+    ustate->uring = u;
+    ustate->task = task;
+    ustate->waiting = 0;
+    ustate->completed = 0;
+    ustate->seen = 0;
+    ustate->armed = 0;
+    ustate->rearm.user_data = 0;
+    task->uring = ustate;
+    return ustate;
+}
+
+
+static void
+_taskstate_put(struct caio_uring *u, struct caio_uring_taskstate *ustate) {
+    if (ustate->task) {
+        ustate->task->uring = NULL;
+        ustate->task = NULL;
+    }
+
+    ustate->next = u->freestates;
+    u->freestates = ustate;
+}
+
+
+static struct caio_uring_job *
+_job_get(struct caio_uring *u, struct caio_uring_taskstate *ustate) {
+    struct caio_uring_job *job = u->freejobs;
+
+    u->freejobs = job->next;
+    job->next = NULL;
+    job->busy = true;
+    job->uring = u;
+    job->ustate = ustate;
+    job->tags = 0;
+    job->release = NULL;
+    job->fd = -1;
+    job->task = NULL;
+    job->cancelled = false;
+    job->rearmpending = false;
+    return job;
+}
+
+
+static void
+_job_put(struct caio_uring *u, struct caio_uring_job *job) {
+    job->busy = false;
+    job->ustate = NULL;
+    job->next = u->freejobs;
+    u->freejobs = job;
+}
+
+
+#define _SQE_JOB(sqe) ((struct caio_uring_job *)(uintptr_t)(sqe)->user_data)
+
+
 struct io_uring_sqe *
 caio_uring_sqe_get(struct caio_uring *u, struct caio_task *task) {
     struct caio_uring_taskstate *ustate = task->uring;
+    struct io_uring_sqe *sqe;
 
-    if (u->jobstotal >= u->jobsmax) {
+    if ((u->jobstotal >= u->jobsmax) || (u->freejobs == NULL)) {
         return NULL;
     }
 
-    struct io_uring_sqe *sqe = io_uring_get_sqe(&(u)->ring);
-    if (sqe == NULL) {
+    if ((ustate != NULL) && ((ustate->waiting + ustate->completed) >=
+            CONFIG_CAIO_URING_TASK_MAXWAITING)) {
         return NULL;
     }
 
-    io_uring_sqe_set_data(sqe, task);
     if (ustate == NULL) {
-        ustate = malloc(sizeof(struct caio_uring_taskstate));
+        ustate = _taskstate_get(u, task);
         if (ustate == NULL) {
             return NULL;
         }
-        ustate->waiting = 0;
-        ustate->completed = 0;
-        task->uring = ustate;
     }
 
-    if (ustate->waiting >= CONFIG_CAIO_URING_TASK_MAXWAITING) {
+    sqe = io_uring_get_sqe(&(u)->ring);
+    if (sqe == NULL) {
+        u->stats.sqfull++;
+        if (ustate->waiting + ustate->completed == 0) {
+            _taskstate_put(u, ustate);
+        }
         return NULL;
     }
 
+    io_uring_sqe_set_data(sqe, _job_get(u, ustate));
     ustate->waiting++;
+    u->queued++;
     u->jobstotal++;
     u->jobswaiting++;
+    if (u->jobswaiting > u->stats.maxinflight) {
+        u->stats.maxinflight = u->jobswaiting;
+    }
     return sqe;
 }
 
 
-static int
-_tick(struct caio *c, struct caio_uring *u, unsigned int timeout_us) {
-    struct io_uring_cqe *cqe;
-    struct caio_task *task;
-    struct caio_uring_taskstate *ustate;
-
-    if (u->jobswaiting == 0) {
-        return 0;
+/* Whether submitting needs io_uring_enter(2), liburing makes the same
+ * decision inside io_uring_submit() */
+static bool
+_submit_enters(struct caio_uring *u) {
+    if (!(u->flags & CAIO_URING_SQPOLL)) {
+        return true;
     }
 
-    if (u->jobswaiting > u->jobstotal) {
-        return -1;
-    }
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    return IO_URING_READ_ONCE(*u->ring.sq.kflags) & IORING_SQ_NEED_WAKEUP;
+}
 
-    struct __kernel_timespec timeout;
-    timeout.tv_sec = timeout_us / 1000000;
-    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
-    int ret = io_uring_wait_cqes(&u->ring, &cqe, u->jobswaiting, &timeout,
-            u->sigmask);
-    if (ret < 0) {
-        if (ret == -ETIME) {
-            return 0;
-        }
-        errno = abs(ret);
-        return -1;
-    }
 
-    u->jobswaiting--;
-    task = (struct caio_task *) io_uring_cqe_get_data(cqe);
-    ustate = task->uring;
-    if (ustate == NULL) {
-        return -1;
+static void
+_submitted(struct caio_uring *u, bool enters) {
+    u->stats.submits += enters;
+    u->stats.submitted += u->queued;
+    if (u->queued > u->stats.maxsubmit) {
+        u->stats.maxsubmit = u->queued;
     }
+    u->queued = 0;
+}
 
-    if (ustate->waiting == 0) {
-        /* weird situation! */
-        return -1;
-    }
 
-    ustate->waiting--;
-    ustate->cqes[ustate->completed++] = cqe;
+static int
+_submit(struct caio_uring *u) {
+    bool enters = _submit_enters(u);
+    int ret;
 
-    if (ustate->waiting) {
-        return 0;
+    ret = io_uring_submit(&u->ring);
+    if (ret >= 0) {
+        _submitted(u, enters);
     }
-
-    if (task->status == CAIO_WAITING) {
-        task->status = CAIO_RUNNING;
+    else if (ret == -EBUSY) {
+        /* The CQ overflowed, the tick reaps it and submits again */
+        u->stats.busy++;
+        ret = 0;
     }
 
-    return 0;
+    return ret;
 }
 
 
-int
-caio_uring_cqe_seen(struct caio_uring *u, struct caio_task *task, int index) {
-    struct caio_uring_taskstate *ustate = task->uring;
-    struct io_uring_cqe *cqe;
+/* Queue the copy of the multishot SQE again, false if the SQ is full */
+static bool
+_rearm_queue(struct caio_uring *u, struct caio_uring_job *job) {
+    struct io_uring_sqe *sqe;
 
-    if (ustate == NULL) {
-        return -1;
+    sqe = io_uring_get_sqe(&u->ring);
+    if ((sqe == NULL) && (_submit(u) >= 0)) {
+        sqe = io_uring_get_sqe(&u->ring);
     }
 
-    if (index == ustate->completed) {
-        return -1;
+    if (sqe == NULL) {
+        return false;
     }
 
-    cqe = ustate->cqes[index];
-    if (cqe == NULL) {
-        return -1;
-    }
+    *sqe = job->ustate->rearm;
+    u->queued++;
+    u->stats.rearms++;
+    return true;
+}
 
-    io_uring_cqe_seen(&u->ring, cqe);
-    ustate->completed--;
-    u->jobstotal--;
 
-    if (ustate->completed == 0) {
-        free(ustate);
-        task->uring = NULL;
+/* Resubmit the multishot job terminated by the kernel, the task does not
+ * notice the gap. Errors and cancellation end the stream as usual. A job
+ * which finds the SQ full stays armed and is resubmitted by the next tick,
+ * see _rearm_retry(). */
+static bool
+_rearm(struct caio_uring *u, struct caio_uring_job *job,
+        struct io_uring_cqe *cqe) {
+    if ((cqe->res < 0) || !(job->tags & CAIO_URING_CQE_REARM)) {
+        return false;
     }
 
-    return 0;
+    if (!_rearm_queue(u, job)) {
+        job->rearmpending = true;
+        u->rearmpending++;
+    }
+
+    return true;
 }
 
 
-struct io_uring_cqe *
-caio_uring_cqe_get(struct caio_task *task, int index) {
-    struct caio_uring_taskstate *ustate = task->uring;
+static void
+_rearm_retry(struct caio_uring *u) {
+    struct caio_uring_job *job;
+    unsigned int i;
 
-    if (ustate == NULL) {
-        return NULL;
+    for (i = 0; (i < u->jobsmax) && u->rearmpending; i++) {
+        job = &u->jobs[i];
+        if (!job->busy || !job->rearmpending) {
+            continue;
+        }
+
+        /* Orphans are retired by _cancel() instead */
+        if ((job->ustate == NULL) || (job->ustate->task == NULL)) {
+            continue;
+        }
+
+        if (!_rearm_queue(u, job)) {
+            return;
+        }
+
+        job->rearmpending = false;
+        u->rearmpending--;
     }
+}
 
-    if (index == ustate->completed) {
-        return NULL;
+
+static void
+_zc_release(struct caio_uring *u, struct caio_uring_job *job) {
+    if (job->release) {
+        job->release(u, (void *)job->buf, job->ptr);
     }
 
-    return ustate->cqes[index];
+    u->zcpending--;
+    _job_put(u, job);
 }
 
 
-struct caio_uring *
-caio_uring_create(struct caio* c, unsigned int jobsmax, sigset_t *sigmask) {
-    struct caio_uring *u;
+/* The job is done, but the zero-copy send keeps the job until the
+ * notification arrives. */
+static void
+_retire(struct caio_uring *u, struct caio_uring_job *job,
+        struct io_uring_cqe *cqe) {
+    struct caio_uring_taskstate *ustate = job->ustate;
 
-    if (jobsmax == 0) {
-        return NULL;
+    u->jobswaiting--;
+    ustate->waiting--;
+    if (job->tags & CAIO_URING_CQE_MULTISHOT) {
+        ustate->armed--;
     }
 
-    /* Create uring instance */
-    u = malloc(sizeof(struct caio_uring));
-    if (u == NULL) {
-        return NULL;
+    if (job->tags & CAIO_URING_CQE_REARM) {
+        ustate->rearm.user_data = 0;
     }
-    memset(u, 0, sizeof(struct caio_uring));
 
-    if (io_uring_queue_init(jobsmax, &u->ring, 0) < 0) {
-        free(u);
-        return NULL;
+    if (!(job->tags & CAIO_URING_CQE_ZEROCOPY)) {
+        _job_put(u, job);
+    }
+    else if (cqe->flags & IORING_CQE_F_MORE) {
+        job->ustate = NULL;
     }
+    else {
+        /* Copied or failed, no notification follows */
+        _zc_release(u, job);
+    }
+}
 
-    u->sigmask = sigmask;
-    u->jobsmax = jobsmax;
-    u->tick = (caio_tick) _tick;
 
-    u->jobstotal = 0;
-    u->jobswaiting = 0;
+/* The readiness CQE wakes the task up, a linked timeout cancels the poll */
+static int
+_fdmon_complete(struct caio_uring *u, struct caio_uring_job *job,
+        struct io_uring_cqe *cqe) {
+    struct caio_task *task = job->task;
 
-    if (caio_module_install(c, (struct caio_module*)u)) {
-        free(u);
-        return NULL;
+    u->polls--;
+    _job_put(u, job);
+    if (task == NULL) {
+        return 0;
     }
+    task->uringpoll = NULL;
 
-    return u;
+    if (cqe->res == -ECANCELED) {
+        task->fdmon_timeout_us = -1;
+    }
+
+    if (task->status == CAIO_WAITING) {
+        task->status = CAIO_RUNNING;
+    }
+
+    return 0;
 }
 
 
-int
-caio_uring_destroy(struct caio* c, struct caio_uring *u) {
-    int ret = 0;
+/* Doubles the inbox, the CQEs behind a message can not wait for the
+ * receiver, it may be waiting for one of them. */
+static int
+_inbox_grow(struct caio_uring *u) {
+    struct caio_uring_message *inbox;
+    unsigned int size = u->inboxsize * 2;
+    unsigned int wrapped;
 
-    if (u == NULL) {
+    inbox = realloc(u->inbox, sizeof(struct caio_uring_message) * size);
+    if (inbox == NULL) {
         return -1;
     }
 
-    io_uring_queue_exit(&u->ring);
-    ret |= caio_module_uninstall(c, (struct caio_module*)u);
-    free(u);
-
-    return ret;
+    /* Unwrap the queue, the new half has room for the wrapped part */
+    wrapped = u->inboxhead + u->inboxcount - u->inboxsize;
+    memcpy(inbox + u->inboxsize, inbox,
+            sizeof(struct caio_uring_message) * wrapped);
+    u->inbox = inbox;
+    u->inboxsize = size;
+    return 0;
 }
 
 
-int
-caio_uring_task_waitingjobs(struct caio_task *task) {
-    struct caio_uring_taskstate *ustate = task->uring;
+/* Queue the message posted by another ring, when the inbox can not grow it
+ * is left in the completion queue until the receiver catches up */
+static int
+_message_complete(struct caio_uring *u, struct io_uring_cqe *cqe) {
+    struct caio_uring_message *msg;
+    struct caio_task *task = u->receiver;
 
-    if (ustate == NULL) {
-        return 0;
+    if ((u->inboxcount == u->inboxsize) && _inbox_grow(u)) {
+        return 1;
     }
 
-    return ustate->waiting;
+    msg = &u->inbox[(u->inboxhead + u->inboxcount++) % u->inboxsize];
+    msg->data = cqe->user_data & CAIO_URING_MESSAGE_DATAMASK;
+    if (cqe->user_data & _MESSAGEFD) {
+        msg->value = 0;
+        msg->fd = CAIO_URING_FIXEDFD(cqe->res);
+    }
+    else {
+        msg->value = cqe->res;
+        msg->fd = -1;
+    }
+    u->stats.received++;
+
+    if (task && (task->status == CAIO_WAITING)) {
+        task->status = CAIO_RUNNING;
+    }
+
+    return 0;
 }
 
 
-int
-caio_uring_task_completed(struct caio_task *task) {
-    struct caio_uring_taskstate *ustate = task->uring;
+/* Returns 1 when the task has no room for the CQE, it must be left in the
+ * completion queue until the task consumes the previous ones. */
+static int
+_complete(struct caio_uring *u, struct io_uring_cqe *cqe) {
+    struct caio_task *task;
+    struct caio_uring_taskstate *ustate;
+    struct caio_uring_job *job;
+    struct io_uring_cqe *copy;
+    bool multishot;
+    bool zerocopy;
 
-    if (ustate == NULL) {
+    if (cqe->user_data & _MESSAGE) {
+        return _message_complete(u, cqe);
+    }
+
+    job = (struct caio_uring_job *) io_uring_cqe_get_data(cqe);
+    if (job == NULL) {
+        /* Cancel requests */
         return 0;
     }
 
-    return ustate->completed;
-}
+    if (cqe->flags & IORING_CQE_F_NOTIF) {
+        _zc_release(u, job);
+        return 0;
+    }
 
+    if (job->fd != -1) {
+        return _fdmon_complete(u, job, cqe);
+    }
 
-int
-caio_uring_task_cleanup(struct caio_uring *u, struct caio_task *task) {
-    struct caio_uring_taskstate *ustate = task->uring;
-    int i;
+    ustate = job->ustate;
+    if ((ustate == NULL) || (ustate->waiting == 0)) {
+        /* weird situation! */
+        return -1;
+    }
 
-    if (ustate == NULL) {
+    multishot = job->tags & CAIO_URING_CQE_MULTISHOT;
+    zerocopy = job->tags & CAIO_URING_CQE_ZEROCOPY;
+    task = ustate->task;
+    if (task == NULL) {
+        /* Orphan, nobody is going to see it */
+        if ((cqe->flags & IORING_CQE_F_MORE) && !zerocopy) {
+            return 0;
+        }
+
+        u->jobstotal--;
+        _retire(u, job, cqe);
+        if (ustate->waiting == 0) {
+            _taskstate_put(u, ustate);
+        }
         return 0;
     }
 
-    for (i = 0; i < ustate->completed; i++) {
-        caio_uring_cqe_seen(u, task, i);
+    if (ustate->completed >= CONFIG_CAIO_URING_TASK_MAXWAITING) {
+        return 1;
     }
 
-    for (i = 0; i < ustate->waiting; i++) {
-        u->jobstotal--;
+    copy = &ustate->cqes[ustate->completed++];
+    *copy = *cqe;
+    copy->user_data = (uintptr_t)task | job->tags;
+    if (!zerocopy && ((cqe->flags & IORING_CQE_F_MORE) ||
+                (multishot && _rearm(u, job, cqe)))) {
+        /* The job is still armed, accounted as an extra job until seen */
+        u->jobstotal++;
+        copy->flags |= IORING_CQE_F_MORE;
+    }
+    else {
+        /* The task does not wait for the zero-copy notification */
+        copy->flags &= ~IORING_CQE_F_MORE;
+        _retire(u, job, cqe);
     }
 
-    free(ustate);
-    task->uring = NULL;
+    /* Multishot completions wake the task up immediately, others when all
+     * the one-shot jobs are done */
+    if (!multishot && (ustate->waiting > ustate->armed)) {
+        return 0;
+    }
+
+    if (task->status == CAIO_WAITING) {
+        task->status = CAIO_RUNNING;
+    }
 
     return 0;
 }
 
 
-#define _CREATE_PREP_SUBMIT(name, umod, task, ...) \
-    struct io_uring_sqe *sqe; \
-    sqe = caio_uring_sqe_get(umod, task); \
-    if (sqe == NULL) return -1; \
-    caio_uring_prep_ ## name(sqe, __VA_ARGS__); \
-    return caio_uring_submit(umod);
+/* Reap everything ready, returns 1 if stopped by a task with no room */
+static int
+_reap(struct caio_uring *u) {
+    struct io_uring_cqe *cqe;
+    unsigned int head;
+    unsigned int count = 0;
+    int ret = 0;
 
+    io_uring_for_each_cqe(&u->ring, head, cqe) {
+        ret = _complete(u, cqe);
+        if (ret) {
+            break;
+        }
+        count++;
+    }
+    io_uring_cq_advance(&u->ring, count);
+
+    if (count) {
+        u->stats.ticks++;
+        u->stats.cqes += count;
+        u->stats.lastbatch = count;
+        if (count > u->stats.maxbatch) {
+            u->stats.maxbatch = count;
+        }
+    }
 
-int
-caio_uring_readv(struct caio_uring *u, struct caio_task *task, int fd,
-        const struct iovec *iovecs, unsigned nrvecs, __u64 offset) {
-    _CREATE_PREP_SUBMIT(readv, u, task, fd, iovecs, nrvecs, offset);
+    return ret;
 }
 
 
-int
-caio_uring_writev(struct caio_uring *u, struct caio_task *task, int fd,
-        const struct iovec *iovecs, unsigned nrvecs, __u64 offset) {
-    _CREATE_PREP_SUBMIT(writev, u, task, fd, iovecs, nrvecs, offset);
-}
+/* Reap everything ready, tasks are woken up in one pass of the loop. A
+ * full task stops it, the rest are reaped by the next tick. */
+static int
+_reap_flush(struct caio_uring *u) {
+    int ret;
 
+    ret = _reap(u);
 
-int
-caio_uring_socket(struct caio_uring *u, struct caio_task *task, int domain,
-        int type, int protocol, unsigned int flags) {
-    _CREATE_PREP_SUBMIT(socket, u, task, domain, type, protocol, flags);
-}
+    /* The completions which did not fit the CQ are held by the kernel until
+     * an io_uring_enter(2) flushes them into the reaped CQ, otherwise their
+     * tasks would wait forever. */
+    if ((ret == 0) && io_uring_cq_has_overflow(&u->ring)) {
+        u->stats.cqoverflows++;
+    }
 
+    while ((ret == 0) && io_uring_cq_has_overflow(&u->ring)) {
+        if ((io_uring_get_events(&u->ring) < 0) ||
+                (io_uring_cq_ready(&u->ring) == 0)) {
+            break;
+        }
+        ret = _reap(u);
+    }
 
-int
-caio_uring_accept(struct caio_uring *u, struct caio_task *task, int sockfd,
-        struct sockaddr *addr, socklen_t *addrlen, unsigned int flags) {
-    _CREATE_PREP_SUBMIT(accept, u, task, sockfd, addr, addrlen, flags);
+    return (ret < 0)? -1: 0;
 }
 
 
-int
-caio_uring_accept_multishot(struct caio_uring *u, struct caio_task *task,
-        int sockfd, struct sockaddr *addr, socklen_t *addrlen,
-        unsigned int flags) {
-    _CREATE_PREP_SUBMIT(accept_multishot, u, task, sockfd, addr, addrlen,
-            flags);
+/* Queues a cancel request for the in-flight job, false if the SQ is
+ * full */
+static bool
+_cancel_job(struct caio_uring *u, struct caio_uring_job *job) {
+    struct io_uring_sqe *sqe;
+
+    sqe = io_uring_get_sqe(&u->ring);
+    if ((sqe == NULL) && (_submit(u) >= 0)) {
+        sqe = io_uring_get_sqe(&u->ring);
+    }
+
+    if (sqe == NULL) {
+        return false;
+    }
+
+    io_uring_prep_cancel(sqe, job, 0);
+    io_uring_sqe_set_data(sqe, NULL);
+    job->cancelled = true;
+    u->queued++;
+    u->stats.cancels++;
+    return true;
+}
+
+
+/* Jobs nobody waits for anymore: of an orphaned task state, or fdmon polls
+ * which are forgotten or whose task is gone */
+#define _ORPHAN(job) \
+    (((job)->ustate && ((job)->ustate->task == NULL)) || \
+     (((job)->fd != -1) && ((job)->task == NULL)))
+
+
+/* Cancel the orphaned in-flight jobs, the ones which found no free SQE are
+ * counted in cancelpending and retried by the next tick. */
+static void
+_cancel(struct caio_uring *u) {
+    struct io_uring_cqe cqe = {0};
+    struct caio_uring_taskstate *ustate;
+    struct caio_uring_job *job;
+    unsigned int i;
+
+    u->cancelpending = 0;
+    for (i = 0; i < u->jobsmax; i++) {
+        job = &u->jobs[i];
+        if (!job->busy || job->cancelled || !_ORPHAN(job)) {
+            continue;
+        }
+
+        /* Not in the kernel, nothing to cancel */
+        if (job->rearmpending) {
+            ustate = job->ustate;
+            u->rearmpending--;
+            u->jobstotal--;
+            _retire(u, job, &cqe);
+            if (ustate->waiting == 0) {
+                _taskstate_put(u, ustate);
+            }
+            continue;
+        }
+
+        if (!_cancel_job(u, job)) {
+            u->cancelpending++;
+        }
+    }
+}
+
+
+/* CAIO_URING_EVENTFD, the fdmon module blocks on the eventfd, so the tick
+ * only submits and reaps. */
+static int
+_tick_nowait(struct caio_uring *u) {
+    if (u->cancelpending) {
+        _cancel(u);
+    }
+
+    if (u->rearmpending) {
+        _rearm_retry(u);
+    }
+
+    if (u->queued && (_submit(u) < 0)) {
+        return -1;
+    }
+
+    /* Completions deferred to io_uring_enter(2), see
+     * CAIO_URING_DEFERTASKRUN and CAIO_URING_COOPTASKRUN */
+    if ((IO_URING_READ_ONCE(*u->ring.sq.kflags) & IORING_SQ_TASKRUN) &&
+            (io_uring_get_events(&u->ring) < 0)) {
+        return -1;
+    }
+
+    if (_reap_flush(u)) {
+        return -1;
+    }
+
+    /* Rearmed multishot jobs */
+    if (u->queued && (_submit(u) < 0)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+_tick(struct caio *c, struct caio_uring *u, unsigned int timeout_us) {
+    struct io_uring_cqe *cqe;
+    unsigned int ready;
+    bool enters;
+    int ret = 0;
+
+    /* Notifications of zero-copy sends may outlive their jobs */
+    if ((u->jobswaiting == 0) && (u->zcpending == 0) && (u->polls == 0) &&
+            (u->receiver == NULL)) {
+        return 0;
+    }
+
+    if (u->jobswaiting > u->jobstotal) {
+        return -1;
+    }
+
+    if (u->eventfd != -1) {
+        return _tick_nowait(u);
+    }
+
+    /* Cancellations and rearms which found the SQ full last time */
+    if (u->cancelpending) {
+        _cancel(u);
+    }
+
+    if (u->rearmpending) {
+        _rearm_retry(u);
+    }
+
+    /* Submitted by the wait below otherwise */
+    if (u->queued && !(u->flags & CAIO_URING_DEFERSUBMIT) &&
+            (_submit(u) < 0)) {
+        return -1;
+    }
+
+    struct __kernel_timespec timeout;
+    timeout.tv_sec = timeout_us / 1000000;
+    timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+    ready = io_uring_cq_ready(&u->ring);
+    enters = false;
+    if ((u->flags & CAIO_URING_DEFERSUBMIT) && u->queued) {
+        /* Everything queued since the last tick, one syscall */
+        enters = _submit_enters(u);
+        ret = io_uring_submit_and_wait_timeout(&u->ring, &cqe, 1, &timeout,
+                u->sigmask);
+        if ((ret >= 0) || (ret == -ETIME)) {
+            _submitted(u, enters);
+        }
+        else if (ret == -EBUSY) {
+            /* Submitted again by the next tick, after the reap below */
+            u->stats.busy++;
+            ret = 0;
+        }
+    }
+    else {
+        ret = io_uring_wait_cqes(&u->ring, &cqe, 1, &timeout, u->sigmask);
+    }
+
+    /* Blocked for completions, unless the submit syscall did it anyway */
+    if (!ready && !enters) {
+        u->stats.waits++;
+    }
+
+    if ((ret < 0) && (ret != -ETIME)) {
+        errno = abs(ret);
+        return -1;
+    }
+
+    ret = _reap_flush(u);
+
+    /* Rearmed multishot jobs */
+    if (u->queued && !(u->flags & CAIO_URING_DEFERSUBMIT) &&
+            (_submit(u) < 0)) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+
+int
+caio_uring_cqe_seen(struct caio_uring *u, struct caio_task *task, int index) {
+    struct caio_uring_taskstate *ustate = task->uring;
+    struct io_uring_cqe *cqe;
+
+    cqe = caio_uring_cqe_get(task, index);
+    if (cqe == NULL) {
+        return -1;
+    }
+
+    cqe->user_data = 0;
+    ustate->seen++;
+    u->jobstotal--;
+
+    if (ustate->seen < ustate->completed) {
+        return 0;
+    }
+
+    if (ustate->waiting) {
+        /* Everything completed so far is consumed, reuse the slots */
+        ustate->completed = 0;
+        ustate->seen = 0;
+        return 0;
+    }
+
+    _taskstate_put(u, ustate);
+    return 0;
+}
+
+
+struct io_uring_cqe *
+caio_uring_cqe_get(struct caio_task *task, int index) {
+    struct caio_uring_taskstate *ustate = task->uring;
+
+    if (ustate == NULL) {
+        return NULL;
+    }
+
+    if ((index < 0) || (index >= ustate->completed)) {
+        return NULL;
+    }
+
+    if (ustate->cqes[index].user_data == 0) {
+        return NULL;
+    }
+
+    return &ustate->cqes[index];
+}
+
+
+int
+caio_uring_submit(struct caio_uring *u) {
+    /* Submitted by the next tick */
+    if (u->flags & CAIO_URING_DEFERSUBMIT) {
+        return 0;
+    }
+
+    return _submit(u);
+}
+
+
+int
+caio_uring_flush(struct caio_uring *u) {
+    if (u->queued == 0) {
+        return 0;
+    }
+
+    return _submit(u);
+}
+
+
+static int
+_buffers_init(struct caio_uring *u, const struct caio_uring_config *config) {
+    struct iovec *iovecs;
+    unsigned int i;
+    int ret;
+
+    if (config->buffers == 0) {
+        return 0;
+    }
+
+    if (config->buffersize == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    u->bufferscount = config->buffers;
+    u->buffersize = config->buffersize;
+    if (posix_memalign((void **)&u->buffers, sysconf(_SC_PAGESIZE),
+                u->buffersize * u->bufferscount)) {
+        u->buffers = NULL;
+        return -1;
+    }
+
+    u->bufferfree = malloc(sizeof(int) * u->bufferscount);
+    u->bufferleased = calloc(u->bufferscount, 1);
+    iovecs = malloc(sizeof(struct iovec) * u->bufferscount);
+    if ((u->bufferfree == NULL) || (u->bufferleased == NULL) ||
+            (iovecs == NULL)) {
+        free(iovecs);
+        return -1;
+    }
+
+    for (i = 0; i < u->bufferscount; i++) {
+        iovecs[i].iov_base = u->buffers + i * u->buffersize;
+        iovecs[i].iov_len = u->buffersize;
+
+        /* Lowest index on top */
+        u->bufferfree[i] = u->bufferscount - i - 1;
+    }
+    u->bufferfreecount = u->bufferscount;
+
+    /* The kernel pins the pages once here, instead of per request */
+    ret = io_uring_register_buffers(&u->ring, iovecs, u->bufferscount);
+    free(iovecs);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static void
+_dispose(struct caio_uring *u) {
+    free(u->states);
+    free(u->jobs);
+    free(u->buffers);
+    free(u->bufferfree);
+    free(u->bufferleased);
+    free(u->inbox);
+    if (u->ringmem) {
+        munmap(u->ringmem, u->ringmemsize);
+    }
+    if (u->eventfd != -1) {
+        close(u->eventfd);
+    }
+    free(u);
+}
+
+
+static int
+_fdmon_monitor(struct caio_uring_fdmon *fdmon, struct caio_task *task,
+        int fd, int events, unsigned int timeout_us) {
+    struct caio_uring *u = fdmon->uring;
+    struct io_uring_sqe *sqe;
+    struct caio_uring_job *job;
+    unsigned int sqes = timeout_us? 2: 1;
+
+    if ((fd < 0) || (u->freejobs == NULL) ||
+            (io_uring_sq_space_left(&u->ring) < sqes)) {
+        return -1;
+    }
+
+    /* Readiness is reported by the CQE, not by the fdmon timestamps */
+    fdmon_task_timestamp_clear(task);
+    task->fdmon_timeout_us = 0;
+
+    job = _job_get(u, NULL);
+    job->fd = fd;
+    job->task = task;
+    task->uringpoll = job;
+
+    /* The events are the same bits as poll(2) */
+    sqe = io_uring_get_sqe(&u->ring);
+    caio_uring_prep_poll_add(sqe, CAIO_URING_ISFIXEDFD(fd)?
+            CAIO_URING_FIXEDINDEX(fd): fd, events);
+    if (CAIO_URING_ISFIXEDFD(fd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    io_uring_sqe_set_data(sqe, job);
+    u->queued++;
+    u->polls++;
+
+    if (timeout_us) {
+        sqe->flags |= IOSQE_IO_LINK;
+        job->timeout.tv_sec = timeout_us / 1000000;
+        job->timeout.tv_nsec = (timeout_us % 1000000) * 1000;
+        sqe = io_uring_get_sqe(&u->ring);
+        io_uring_prep_link_timeout(sqe, &job->timeout, 0);
+        io_uring_sqe_set_data(sqe, NULL);
+        u->queued++;
+    }
+
+    return (caio_uring_submit(u) < 0)? -1: 0;
+}
+
+
+/* Detaches the poll from its task, so a late CQE is dropped, and cancels
+ * it, by the next tick if the SQ is full */
+static int
+_fdmon_orphan(struct caio_uring *u, struct caio_uring_job *job) {
+    job->task->uringpoll = NULL;
+    job->task = NULL;
+    if (!_cancel_job(u, job)) {
+        u->cancelpending++;
+        return 0;
+    }
+
+    return (caio_uring_submit(u) < 0)? -1: 0;
+}
+
+
+/* Removes the poll armed for the file, if any, so the file can be closed
+ * right after */
+static int
+_fdmon_forget(struct caio_uring_fdmon *fdmon, int fd) {
+    struct caio_uring *u = fdmon->uring;
+    struct caio_uring_job *job;
+    unsigned int i;
+
+    for (i = 0; u->polls && (i < u->jobsmax); i++) {
+        job = &u->jobs[i];
+        if (!job->busy || (job->fd != fd) || (job->task == NULL)) {
+            continue;
+        }
+
+        return _fdmon_orphan(u, job);
+    }
+
+    return 0;
+}
+
+
+struct caio_fdmon *
+caio_uring_fdmon(struct caio_uring *u) {
+    return (struct caio_fdmon *)&u->fdmon;
+}
+
+
+static void
+_params_build(struct io_uring_params *params,
+        const struct caio_uring_config *config, int flags) {
+    memset(params, 0, sizeof(struct io_uring_params));
+    if (flags & CAIO_URING_SQPOLL) {
+        params->flags |= IORING_SETUP_SQPOLL;
+        params->sq_thread_idle = config->sqpollidle;
+        if (config->sqpollcpu >= 0) {
+            params->flags |= IORING_SETUP_SQ_AFF;
+            params->sq_thread_cpu = config->sqpollcpu;
+        }
+    }
+
+    if (config->cqsize) {
+        params->flags |= IORING_SETUP_CQSIZE;
+        params->cq_entries = config->cqsize;
+    }
+
+    if (flags & CAIO_URING_SINGLEISSUER) {
+        params->flags |= IORING_SETUP_SINGLE_ISSUER;
+    }
+
+    if (flags & CAIO_URING_DEFERTASKRUN) {
+        params->flags |= IORING_SETUP_DEFER_TASKRUN;
+    }
+
+    if (flags & CAIO_URING_COOPTASKRUN) {
+        params->flags |= IORING_SETUP_COOP_TASKRUN;
+    }
+
+    /* So liburing knows when deferred completions need a syscall */
+    if (flags & (CAIO_URING_DEFERTASKRUN | CAIO_URING_COOPTASKRUN)) {
+        params->flags |= IORING_SETUP_TASKRUN_FLAG;
+    }
+}
+
+
+/* Rough size of the rings and the SQE array, the ring headers fit in the
+ * page added */
+static size_t
+_ringmem_size(unsigned int entries, const struct io_uring_params *params) {
+    size_t sq = 1;
+    size_t cq;
+
+    while (sq < entries) {
+        sq <<= 1;
+    }
+
+    cq = (params->flags & IORING_SETUP_CQSIZE)? params->cq_entries: sq * 2;
+    return sq * (sizeof(struct io_uring_sqe) + sizeof(__u32)) +
+        cq * sizeof(struct io_uring_cqe) + 4096;
+}
+
+
+/* CAIO_URING_HUGEPAGES, the rings and the SQEs are put in huge pages
+ * (IORING_SETUP_NO_MMAP), so submissions and completions touch one TLB
+ * entry instead of one per 4K page. Falls back to the kernel allocated
+ * rings when no huge page is available (vm.nr_hugepages) or the kernel or
+ * liburing does not support it. */
+static int
+_queue_init(struct caio_uring *u, unsigned int entries,
+        struct io_uring_params *params, int *flags) {
+    struct io_uring_params backup = *params;
+    size_t size;
+    int ret;
+
+    if (!(*flags & CAIO_URING_HUGEPAGES)) {
+        return io_uring_queue_init_params(entries, &u->ring, params);
+    }
+
+    size = _ringmem_size(entries, params);
+    size = (size + CAIO_URING_HUGEPAGE_SIZE - 1) &
+        ~((size_t)CAIO_URING_HUGEPAGE_SIZE - 1);
+    u->ringmem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (u->ringmem != MAP_FAILED) {
+        u->ringmemsize = size;
+        ret = io_uring_queue_init_mem(entries, &u->ring, params, u->ringmem,
+                size);
+        if (ret >= 0) {
+            return 0;
+        }
+
+        munmap(u->ringmem, size);
+    }
+
+    u->ringmem = NULL;
+    u->ringmemsize = 0;
+    *flags &= ~CAIO_URING_HUGEPAGES;
+    *params = backup;
+    return io_uring_queue_init_params(entries, &u->ring, params);
+}
+
+
+/* Older kernels reject the newer setup flags with EINVAL, they are dropped
+ * newest first (DEFER_TASKRUN 6.1, SINGLE_ISSUER 6.0, COOP_TASKRUN 5.19)
+ * until the ring is created. */
+static int
+_ring_init(struct caio_uring *u, const struct caio_uring_config *config) {
+    static const int fallbacks[] = {
+        CAIO_URING_DEFERTASKRUN,
+        CAIO_URING_SINGLEISSUER,
+        CAIO_URING_COOPTASKRUN,
+        0,
+    };
+    struct io_uring_params params;
+    unsigned int entries;
+    int flags = config->flags;
+    int i = 0;
+    int ret;
+
+    if (flags & CAIO_URING_DEFERTASKRUN) {
+        flags |= CAIO_URING_SINGLEISSUER;
+    }
+
+    entries = config->sqsize? config->sqsize: config->jobsmax;
+    while (true) {
+        _params_build(&params, config, flags);
+        ret = _queue_init(u, entries, &params, &flags);
+        if (ret != -EINVAL) {
+            break;
+        }
+
+        while (fallbacks[i] && !(flags & fallbacks[i])) {
+            i++;
+        }
+
+        if (fallbacks[i] == 0) {
+            break;
+        }
+
+        flags &= ~fallbacks[i];
+    }
+
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    if ((flags & CAIO_URING_REGISTERRING) &&
+            (io_uring_register_ring_fd(&u->ring) != 1)) {
+        flags &= ~CAIO_URING_REGISTERRING;
+    }
+
+    u->flags = flags;
+    return 0;
+}
+
+
+struct caio_uring *
+caio_uring_create_config(struct caio* c,
+        const struct caio_uring_config *config) {
+    struct caio_uring *u;
+    unsigned int i;
+    unsigned int jobsmax;
+
+    if ((config == NULL) || (config->jobsmax == 0)) {
+        return NULL;
+    }
+    jobsmax = config->jobsmax;
+
+    /* Create uring instance */
+    u = malloc(sizeof(struct caio_uring));
+    if (u == NULL) {
+        return NULL;
+    }
+    memset(u, 0, sizeof(struct caio_uring));
+    u->eventfd = -1;
+
+    u->states = malloc(sizeof(struct caio_uring_taskstate) * jobsmax);
+    if (u->states == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < jobsmax; i++) {
+        u->states[i].next = (i + 1) < jobsmax? &u->states[i + 1]: NULL;
+    }
+    u->freestates = u->states;
+
+    u->jobs = calloc(jobsmax, sizeof(struct caio_uring_job));
+    if (u->jobs == NULL) {
+        goto failed;
+    }
+
+    for (i = 0; i < jobsmax; i++) {
+        u->jobs[i].next = (i + 1) < jobsmax? &u->jobs[i + 1]: NULL;
+    }
+    u->freejobs = u->jobs;
+
+    if (config->messages) {
+        u->inbox = malloc(sizeof(struct caio_uring_message) *
+                config->messages);
+        if (u->inbox == NULL) {
+            goto failed;
+        }
+        u->inboxsize = config->messages;
+    }
+
+    if (_ring_init(u, config)) {
+        goto failed;
+    }
+
+    if (_buffers_init(u, config)) {
+        goto failedring;
+    }
+
+    if (config->files &&
+            (io_uring_register_files_sparse(&u->ring, config->files) < 0)) {
+        goto failedring;
+    }
+
+    if (config->flags & CAIO_URING_EVENTFD) {
+        /* The fallback above may have left the task work interrupting the
+         * fdmon wait, see CAIO_URING_EVENTFD */
+        if (!(u->flags & (CAIO_URING_DEFERTASKRUN |
+                        CAIO_URING_COOPTASKRUN))) {
+            errno = EOPNOTSUPP;
+            goto failedring;
+        }
+
+        u->eventfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if ((u->eventfd == -1) ||
+                (io_uring_register_eventfd(&u->ring, u->eventfd) < 0)) {
+            goto failedring;
+        }
+    }
+
+    u->sigmask = config->sigmask;
+    u->zcthreshold = config->zcthreshold;
+    u->fdmon.uring = u;
+    u->fdmon.monitor = (caio_filemonitor)_fdmon_monitor;
+    u->fdmon.forget = (caio_fileforget)_fdmon_forget;
+    u->jobsmax = jobsmax;
+    u->tick = (caio_tick) _tick;
+
+    u->jobstotal = 0;
+    u->jobswaiting = 0;
+
+    if (caio_module_install(c, (struct caio_module*)u)) {
+        goto failedring;
+    }
+
+    return u;
+
+failedring:
+    io_uring_queue_exit(&u->ring);
+
+failed:
+    _dispose(u);
+    return NULL;
+}
+
+
+struct caio_uring *
+caio_uring_create(struct caio* c, unsigned int jobsmax, sigset_t *sigmask) {
+    struct caio_uring_config config = {
+        .jobsmax = jobsmax,
+        .sigmask = sigmask,
+        .flags = 0,
+        .sqpollcpu = -1,
+    };
+
+    return caio_uring_create_config(c, &config);
+}
+
+
+int
+caio_uring_stats_get(struct caio_uring *u, struct caio_uring_stats *stats) {
+    if ((u == NULL) || (stats == NULL)) {
+        return -1;
+    }
+
+    *stats = u->stats;
+    stats->inflight = u->jobswaiting;
+    stats->cqdropped = *u->ring.cq.koverflow;
+    return 0;
+}
+
+
+int
+caio_uring_flags_get(struct caio_uring *u) {
+    return u->flags;
+}
+
+
+int
+caio_uring_eventfd(struct caio_uring *u) {
+    return u->eventfd;
+}
+
+
+int
+caio_uring_destroy(struct caio* c, struct caio_uring *u) {
+    unsigned int i;
+    int ret = 0;
+
+    if (u == NULL) {
+        return -1;
+    }
+
+    io_uring_queue_exit(&u->ring);
+
+    /* The kernel has dropped the pages of the unnotified sends by now */
+    for (i = 0; i < u->jobsmax; i++) {
+        if (u->jobs[i].busy &&
+                (u->jobs[i].tags & CAIO_URING_CQE_ZEROCOPY)) {
+            _zc_release(u, &u->jobs[i]);
+        }
+    }
+
+    ret |= caio_module_uninstall(c, (struct caio_module*)u);
+    _dispose(u);
+
+    return ret;
+}
+
+
+int
+caio_uring_buffer_lease(struct caio_uring *u, void **buff) {
+    int index;
+
+    if (u->bufferfreecount == 0) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    index = u->bufferfree[--u->bufferfreecount];
+    u->bufferleased[index] = 1;
+    if (buff) {
+        *buff = u->buffers + index * u->buffersize;
+    }
+
+    return index;
+}
+
+
+int
+caio_uring_buffer_release(struct caio_uring *u, int index) {
+    if ((index < 0) || (index >= u->bufferscount) ||
+            (!u->bufferleased[index])) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    u->bufferleased[index] = 0;
+    u->bufferfree[u->bufferfreecount++] = index;
+    return 0;
+}
+
+
+void *
+caio_uring_buffer_get(struct caio_uring *u, int index) {
+    if ((index < 0) || (index >= u->bufferscount)) {
+        return NULL;
+    }
+
+    return u->buffers + index * u->buffersize;
+}
+
+
+size_t
+caio_uring_buffer_size(struct caio_uring *u) {
+    return u->buffersize;
+}
+
+
+int
+caio_uring_buffers_register(struct caio_uring *u, const struct iovec *iovecs,
+        unsigned int count) {
+    int ret;
+
+    if (u->bufferscount) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    ret = io_uring_register_buffers(&u->ring, iovecs, count);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+caio_uring_buffers_unregister(struct caio_uring *u) {
+    int ret;
+
+    if (u->bufferscount) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    ret = io_uring_unregister_buffers(&u->ring);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+int
+caio_uring_task_waitingjobs(struct caio_task *task) {
+    struct caio_uring_taskstate *ustate = task->uring;
+
+    if (ustate == NULL) {
+        return 0;
+    }
+
+    return ustate->waiting;
+}
+
+
+int
+caio_uring_task_completed(struct caio_task *task) {
+    struct caio_uring_taskstate *ustate = task->uring;
+
+    if (ustate == NULL) {
+        return 0;
+    }
+
+    return ustate->completed;
+}
+
+
+int
+caio_uring_sqe_multishot(struct caio_task *task, struct io_uring_sqe *sqe) {
+    struct caio_uring_taskstate *ustate = task->uring;
+
+    if (ustate == NULL) {
+        return -1;
+    }
+
+    _SQE_JOB(sqe)->tags |= CAIO_URING_CQE_MULTISHOT;
+    ustate->armed++;
+    return 0;
+}
+
+
+int
+caio_uring_task_cleanup(struct caio_uring *u, struct caio_task *task) {
+    struct caio_uring_taskstate *ustate = task->uring;
+    int i;
+
+    if (ustate == NULL) {
+        return 0;
+    }
+
+    for (i = 0; i < ustate->completed; i++) {
+        if (ustate->cqes[i].user_data) {
+            u->jobstotal--;
+        }
+    }
+
+    if (ustate->waiting == 0) {
+        _taskstate_put(u, ustate);
+        return 0;
+    }
+
+    /* Orphan the in-flight jobs and cancel them, the state is released by
+     * the last CQE. The tick reaps the ones not completed yet, the loop does
+     * not wait for them. */
+    ustate->task = NULL;
+    ustate->completed = 0;
+    ustate->seen = 0;
+    task->uring = NULL;
+    _cancel(u);
+    if (_submit(u) < 0) {
+        return -1;
+    }
+
+    /* Whatever is ready already, a live task's CQEs may stop it */
+    return (_reap(u) < 0)? -1: 0;
+}
+
+
+int
+caio_uring_task_dispose(struct caio_task *task) {
+    struct caio_uring_job *job = task->uringpoll;
+    int ret = 0;
+
+    /* Killed while waiting for a file, the poll and its linked timeout are
+     * cancelled */
+    if (job) {
+        ret = _fdmon_orphan(job->uring, job);
+    }
+
+    if (task->uring == NULL) {
+        return ret;
+    }
+
+    return caio_uring_task_cleanup(task->uring->uring, task) | ret;
+}
+
+
+#define _CREATE_PREP_SUBMIT(name, umod, task, ...) \
+    struct io_uring_sqe *sqe; \
+    sqe = caio_uring_sqe_get(umod, task); \
+    if (sqe == NULL) return -1; \
+    caio_uring_prep_ ## name(sqe, __VA_ARGS__); \
+    return caio_uring_submit(umod);
+
+
+/* Same as above, but the first argument is a file descriptor which may be
+ * a direct descriptor */
+#define _CREATE_PREP_SUBMIT_FD(name, umod, task, fd, ...) \
+    struct io_uring_sqe *sqe; \
+    sqe = caio_uring_sqe_get(umod, task); \
+    if (sqe == NULL) return -1; \
+    caio_uring_prep_ ## name(sqe, CAIO_URING_ISFIXEDFD(fd)? \
+            CAIO_URING_FIXEDINDEX(fd): (fd), __VA_ARGS__); \
+    if (CAIO_URING_ISFIXEDFD(fd)) sqe->flags |= IOSQE_FIXED_FILE; \
+    return caio_uring_submit(umod);
+
+
+int
+caio_uring_readv(struct caio_uring *u, struct caio_task *task, int fd,
+        const struct iovec *iovecs, unsigned nrvecs, __u64 offset) {
+    _CREATE_PREP_SUBMIT_FD(readv, u, task, fd, iovecs, nrvecs, offset);
+}
+
+
+int
+caio_uring_writev(struct caio_uring *u, struct caio_task *task, int fd,
+        const struct iovec *iovecs, unsigned nrvecs, __u64 offset) {
+    _CREATE_PREP_SUBMIT_FD(writev, u, task, fd, iovecs, nrvecs, offset);
+}
+
+
+int
+caio_uring_socket(struct caio_uring *u, struct caio_task *task, int domain,
+        int type, int protocol, unsigned int flags) {
+    _CREATE_PREP_SUBMIT(socket, u, task, domain, type, protocol, flags);
+}
+
+
+int
+caio_uring_accept(struct caio_uring *u, struct caio_task *task, int sockfd,
+        struct sockaddr *addr, socklen_t *addrlen, unsigned int flags) {
+    _CREATE_PREP_SUBMIT_FD(accept, u, task, sockfd, addr, addrlen, flags);
+}
+
+
+int
+caio_uring_accept_multishot(struct caio_uring *u, struct caio_task *task,
+        int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+        unsigned int flags) {
+    struct io_uring_sqe *sqe;
+    struct caio_uring_taskstate *ustate;
+
+    /* One automatically rearmed job per task */
+    ustate = task->uring;
+    if (ustate && ustate->rearm.user_data) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    sqe = caio_uring_sqe_get(u, task);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    caio_uring_prep_accept_multishot(sqe, CAIO_URING_ISFIXEDFD(sockfd)?
+            CAIO_URING_FIXEDINDEX(sockfd): sockfd, addr, addrlen, flags);
+    if (CAIO_URING_ISFIXEDFD(sockfd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    caio_uring_sqe_multishot(task, sqe);
+    _SQE_JOB(sqe)->tags |= CAIO_URING_CQE_REARM;
+
+    ustate = task->uring;
+    ustate->rearm = *sqe;
+    return caio_uring_submit(u);
 }
 
 
 int
 caio_uring_read(struct caio_uring *u, struct caio_task *task, int fd,
         void *buf, unsigned nbytes, __u64 offset) {
-    _CREATE_PREP_SUBMIT(read, u, task, fd, buf, nbytes, offset);
+    _CREATE_PREP_SUBMIT_FD(read, u, task, fd, buf, nbytes, offset);
 }
 
 
 int
 caio_uring_write(struct caio_uring *u, struct caio_task *task, int fd,
         void *buf, unsigned nbytes, __u64 offset) {
-    _CREATE_PREP_SUBMIT(write, u, task, fd, buf, nbytes, offset);
+    _CREATE_PREP_SUBMIT_FD(write, u, task, fd, buf, nbytes, offset);
+}
+
+
+/* buf/nbytes must be inside the registered buffer index */
+static int
+_buffer_check(struct caio_uring *u, const void *buf, unsigned nbytes,
+        int index) {
+    const char *start = caio_uring_buffer_get(u, index);
+
+    if ((start == NULL) || ((const char *)buf < start) ||
+            (((const char *)buf + nbytes) > (start + u->buffersize))) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* Same as _CREATE_PREP_SUBMIT_FD, but all the failures are -errno */
+#define _CREATE_PREP_SUBMIT_FD_ERRNO(name, umod, task, fd, ...) \
+    struct io_uring_sqe *sqe; \
+    sqe = caio_uring_sqe_get(umod, task); \
+    if (sqe == NULL) return -EBUSY; \
+    caio_uring_prep_ ## name(sqe, CAIO_URING_ISFIXEDFD(fd)? \
+            CAIO_URING_FIXEDINDEX(fd): (fd), __VA_ARGS__); \
+    if (CAIO_URING_ISFIXEDFD(fd)) sqe->flags |= IOSQE_FIXED_FILE; \
+    return caio_uring_submit(umod);
+
+
+int
+caio_uring_read_fixed(struct caio_uring *u, struct caio_task *task, int fd,
+        void *buf, unsigned nbytes, __u64 offset, int bufindex) {
+    if (_buffer_check(u, buf, nbytes, bufindex)) {
+        return -EINVAL;
+    }
+
+    _CREATE_PREP_SUBMIT_FD_ERRNO(read_fixed, u, task, fd, buf, nbytes,
+            offset, bufindex);
+}
+
+
+int
+caio_uring_write_fixed(struct caio_uring *u, struct caio_task *task, int fd,
+        const void *buf, unsigned nbytes, __u64 offset, int bufindex) {
+    if (_buffer_check(u, buf, nbytes, bufindex)) {
+        return -EINVAL;
+    }
+
+    _CREATE_PREP_SUBMIT_FD_ERRNO(write_fixed, u, task, fd, buf, nbytes,
+            offset, bufindex);
+}
+
+
+int
+caio_uring_accept_direct(struct caio_uring *u, struct caio_task *task,
+        int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+        unsigned int flags) {
+    _CREATE_PREP_SUBMIT_FD(accept_direct, u, task, sockfd, addr, addrlen,
+            flags, IORING_FILE_INDEX_ALLOC);
+}
+
+
+int
+caio_uring_socket_direct(struct caio_uring *u, struct caio_task *task,
+        int domain, int type, int protocol, unsigned int flags) {
+    _CREATE_PREP_SUBMIT(socket_direct_alloc, u, task, domain, type, protocol,
+            flags);
+}
+
+
+int
+caio_uring_openat_direct(struct caio_uring *u, struct caio_task *task,
+        int dfd, const char *path, int flags, mode_t mode) {
+    _CREATE_PREP_SUBMIT(openat_direct, u, task, dfd, path, flags, mode,
+            IORING_FILE_INDEX_ALLOC);
+}
+
+
+int
+caio_uring_close_direct(struct caio_uring *u, struct caio_task *task,
+        int fd) {
+    _CREATE_PREP_SUBMIT(close_direct, u, task, CAIO_URING_FIXEDINDEX(fd));
+}
+
+
+struct caio_uring_bufring *
+caio_uring_bufring_create(struct caio_uring *u, int bgid, unsigned int count,
+        size_t size) {
+    struct caio_uring_bufring *r;
+    unsigned int i;
+    int ret;
+
+    /* The kernel requires a power of two ring size */
+    if ((count == 0) || (count > 32768) || (count & (count - 1)) ||
+            (size == 0)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    r = malloc(sizeof(struct caio_uring_bufring));
+    if (r == NULL) {
+        return NULL;
+    }
+    memset(r, 0, sizeof(struct caio_uring_bufring));
+
+    r->buffers = malloc(count * size);
+    if (r->buffers == NULL) {
+        goto failed;
+    }
+
+    r->br = io_uring_setup_buf_ring(&u->ring, count, bgid, 0, &ret);
+    if (r->br == NULL) {
+        errno = -ret;
+        goto failed;
+    }
+
+    r->uring = u;
+    r->bgid = bgid;
+    r->count = count;
+    r->size = size;
+    r->mask = io_uring_buf_ring_mask(count);
+
+    /* Hand all the buffers to the kernel */
+    for (i = 0; i < count; i++) {
+        io_uring_buf_ring_add(r->br, r->buffers + i * size, size, i, r->mask,
+                i);
+    }
+    io_uring_buf_ring_advance(r->br, count);
+    return r;
+
+failed:
+    free(r->buffers);
+    free(r);
+    return NULL;
+}
+
+
+int
+caio_uring_bufring_destroy(struct caio_uring_bufring *r) {
+    int ret;
+
+    if (r == NULL) {
+        return -1;
+    }
+
+    ret = io_uring_free_buf_ring(&r->uring->ring, r->br, r->count, r->bgid);
+    free(r->buffers);
+    free(r);
+    if (ret < 0) {
+        errno = -ret;
+        return -1;
+    }
+
+    return 0;
+}
+
+
+void *
+caio_uring_bufring_get(struct caio_uring_bufring *r, int bid) {
+    if ((bid < 0) || ((unsigned int)bid >= r->count)) {
+        return NULL;
+    }
+
+    return r->buffers + bid * r->size;
+}
+
+
+int
+caio_uring_bufring_release(struct caio_uring_bufring *r, int bid) {
+    if ((bid < 0) || ((unsigned int)bid >= r->count)) {
+        return -1;
+    }
+
+    io_uring_buf_ring_add(r->br, r->buffers + bid * r->size, r->size, bid,
+            r->mask, 0);
+    io_uring_buf_ring_advance(r->br, 1);
+    return 0;
+}
+
+
+int
+caio_uring_recv_multishot(struct caio_uring *u, struct caio_task *task,
+        int fd, struct caio_uring_bufring *r, int flags) {
+    struct io_uring_sqe *sqe;
+
+    sqe = caio_uring_sqe_get(u, task);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    caio_uring_prep_recv_multishot(sqe, CAIO_URING_ISFIXEDFD(fd)?
+            CAIO_URING_FIXEDINDEX(fd): fd, NULL, 0, flags);
+    if (CAIO_URING_ISFIXEDFD(fd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    /* The kernel picks a buffer from the ring when data arrives */
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = r->bgid;
+    caio_uring_sqe_multishot(task, sqe);
+    return caio_uring_submit(u);
+}
+
+
+int
+caio_uring_chain_begin(struct caio_uring_chain *chain, struct caio_uring *u,
+        struct caio_task *task, unsigned int length) {
+    struct caio_uring_taskstate *ustate = task->uring;
+    unsigned int busy = 0;
+
+    if (ustate) {
+        busy = ustate->waiting + ustate->completed;
+    }
+
+    if (io_uring_sq_space_left(&u->ring) < length) {
+        u->stats.sqfull++;
+        errno = ENOSPC;
+        return -1;
+    }
+
+    if ((length == 0) || (length > 0xFF) ||
+            ((busy + length) > CONFIG_CAIO_URING_TASK_MAXWAITING) ||
+            ((u->jobstotal + length) > u->jobsmax)) {
+        errno = ENOSPC;
+        return -1;
+    }
+
+    chain->uring = u;
+    chain->task = task;
+    chain->last = NULL;
+    chain->length = length;
+    chain->count = 0;
+    return 0;
+}
+
+
+struct io_uring_sqe *
+caio_uring_chain_sqe_get(struct caio_uring_chain *chain, bool hard) {
+    struct io_uring_sqe *sqe;
+
+    if (chain->count >= chain->length) {
+        return NULL;
+    }
+
+    sqe = caio_uring_sqe_get(chain->uring, chain->task);
+    if (sqe == NULL) {
+        return NULL;
+    }
+
+    if (chain->last) {
+        chain->last->flags |= hard? IOSQE_IO_HARDLINK: IOSQE_IO_LINK;
+    }
+
+    chain->count++;
+    _SQE_JOB(sqe)->tags |=
+        (__u64)chain->count << CAIO_URING_CQE_POSITIONSHIFT;
+    chain->last = sqe;
+    return sqe;
+}
+
+
+int
+caio_uring_chain_submit(struct caio_uring_chain *chain) {
+    chain->last = NULL;
+    return caio_uring_submit(chain->uring);
+}
+
+
+struct io_uring_cqe *
+caio_uring_chain_cqe(struct caio_task *task, unsigned int position) {
+    struct caio_uring_taskstate *ustate = task->uring;
+    __u64 tag = (__u64)(position + 1) << CAIO_URING_CQE_POSITIONSHIFT;
+    unsigned int i;
+
+    if (ustate == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < ustate->completed; i++) {
+        if (ustate->cqes[i].user_data &&
+                ((ustate->cqes[i].user_data & CAIO_URING_CQE_POSITIONMASK) ==
+                 tag)) {
+            return &ustate->cqes[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+int
+caio_uring_chain_seen(struct caio_uring *u, struct caio_task *task) {
+    struct io_uring_cqe *cqe;
+    int completed = caio_uring_task_completed(task);
+    int i;
+
+    if (completed == 0) {
+        return -1;
+    }
+
+    /* The last one may release the task state, hence caio_uring_cqe_get() */
+    for (i = 0; i < completed; i++) {
+        cqe = caio_uring_cqe_get(task, i);
+        if (cqe && (cqe->user_data & CAIO_URING_CQE_POSITIONMASK)) {
+            caio_uring_cqe_seen(u, task, i);
+        }
+    }
+
+    return 0;
+}
+
+
+int
+caio_uring_send_zc(struct caio_uring *u, struct caio_task *task, int fd,
+        const void *buf, size_t len, int flags, caio_uring_release release,
+        void *ptr) {
+    struct io_uring_sqe *sqe;
+    struct caio_uring_job *job;
+
+    sqe = caio_uring_sqe_get(u, task);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    /* Pinning the pages and the extra CQE cost more than copying a small
+     * buffer */
+    if (len < u->zcthreshold) {
+        caio_uring_prep_send(sqe, CAIO_URING_ISFIXEDFD(fd)?
+                CAIO_URING_FIXEDINDEX(fd): fd, buf, len, flags);
+        u->stats.copied++;
+    }
+    else {
+        caio_uring_prep_send_zc(sqe, CAIO_URING_ISFIXEDFD(fd)?
+                CAIO_URING_FIXEDINDEX(fd): fd, buf, len, flags, 0);
+        u->stats.zerocopy++;
+    }
+
+    if (CAIO_URING_ISFIXEDFD(fd)) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+
+    job = _SQE_JOB(sqe);
+    job->tags |= CAIO_URING_CQE_ZEROCOPY;
+    job->buf = buf;
+    job->release = release;
+    job->ptr = ptr;
+    u->zcpending++;
+    return caio_uring_submit(u);
+}
+
+
+int
+caio_uring_message_post(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring *target, __u64 data, int value) {
+    struct io_uring_sqe *sqe;
+
+    if ((target->inboxsize == 0) || (data & ~CAIO_URING_MESSAGE_DATAMASK)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sqe = caio_uring_sqe_get(u, task);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    /* value arrives as the res of the target CQE */
+    caio_uring_prep_msg_ring(sqe, target->ring.ring_fd, value,
+            data | _MESSAGE, 0);
+    u->stats.posted++;
+    return caio_uring_submit(u);
+}
+
+
+int
+caio_uring_message_postfd(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring *target, int fd, __u64 data) {
+    struct io_uring_sqe *sqe;
+
+    if (!CAIO_URING_ISFIXEDFD(fd)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    if ((target->inboxsize == 0) || (data & ~CAIO_URING_MESSAGE_DATAMASK)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    sqe = caio_uring_sqe_get(u, task);
+    if (sqe == NULL) {
+        return -1;
+    }
+
+    /* The target CQE reports the allocated index in res */
+    caio_uring_prep_msg_ring_fd_alloc(sqe, target->ring.ring_fd,
+            CAIO_URING_FIXEDINDEX(fd), data | _MESSAGE | _MESSAGEFD, 0);
+    u->stats.posted++;
+    return caio_uring_submit(u);
+}
+
+
+int
+caio_uring_message_receive(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring_message *msg) {
+    if (u->inboxsize == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    if (u->inboxcount == 0) {
+        if (u->receiver && (u->receiver != task)) {
+            errno = EBUSY;
+            return -1;
+        }
+
+        u->receiver = task;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    *msg = u->inbox[u->inboxhead];
+    u->inboxhead = (u->inboxhead + 1) % u->inboxsize;
+    u->inboxcount--;
+    if (u->receiver == task) {
+        u->receiver = NULL;
+    }
+
+    return 0;
+}
+
+
+ASYNC
+caio_uring_messageA(struct caio_task *self, struct caio_uring_message *msg,
+        struct caio_uring *u) {
+    CAIO_BEGIN(self);
+
+    while (caio_uring_message_receive(u, self, msg)) {
+        if (errno != EAGAIN) {
+            CAIO_THROW(self, errno);
+        }
+
+        CAIO_PASS(self, CAIO_WAITING);
+    }
+
+    CAIO_FINALLY(self);
+    if (u->receiver == self) {
+        u->receiver = NULL;
+    }
 }
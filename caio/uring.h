@@ -20,14 +20,226 @@
 #define CAIO_URING_H_
 
 
+#include <stdbool.h>
 #include <sys/socket.h>
 
 #include <liburing.h>
 
 #include "caio/caio.h"
+#include "caio/fdmon.h"
 
 
 struct caio_uring;
+struct caio_uring_bufring;
+typedef void (*caio_uring_release) (struct caio_uring *u, void *buf,
+        void *ptr);
+
+
+struct caio_uring_stats {
+    /* ticks which reaped at least one CQE */
+    unsigned long ticks;
+
+    /* total reaped CQEs */
+    unsigned long cqes;
+
+    /* CQEs reaped by the last and the busiest tick */
+    unsigned int lastbatch;
+    unsigned int maxbatch;
+
+    /* submit syscalls and the SQEs submitted by them, with
+     * CAIO_URING_SQPOLL only the submissions which had to wake up the
+     * kernel thread are counted as syscalls */
+    unsigned long submits;
+    unsigned long submitted;
+
+    /* ticks which had to block in io_uring_enter(2) for a completion */
+    unsigned long waits;
+
+    /* multishot jobs resubmitted after the kernel terminated them */
+    unsigned long rearms;
+
+    /* caio_uring_send_zc() calls, sent zero-copy and copied because of
+     * the zcthreshold */
+    unsigned long zerocopy;
+    unsigned long copied;
+
+    /* in-flight jobs cancelled because their task was terminated */
+    unsigned long cancels;
+
+    /* messages posted to the other rings and received from them */
+    unsigned long posted;
+    unsigned long received;
+
+    /* SQEs refused because the submission queue was full */
+    unsigned long sqfull;
+
+    /* ticks which found completions held by the kernel because the CQ was
+     * full (IORING_SQ_CQ_OVERFLOW), they are flushed into the CQ as it is
+     * reaped. cqdropped is the kernel's count of the lost ones. */
+    unsigned long cqoverflows;
+    unsigned long cqdropped;
+
+    /* submissions refused with EBUSY while the CQ overflowed, the SQEs stay
+     * queued and the next tick submits them */
+    unsigned long busy;
+
+    /* submitted jobs waiting for their completion, now and the peak */
+    unsigned int inflight;
+    unsigned int maxinflight;
+
+    /* SQEs of the biggest submission */
+    unsigned int maxsubmit;
+};
+
+
+enum caio_uring_flags {
+    /* Only queue SQEs in caio_uring_submit() and the all-in-one helpers,
+     * the module tick submits all of them and waits for completions with a
+     * single io_uring_enter(2). Use caio_uring_flush() when a job must be
+     * submitted before the task continues. */
+    CAIO_URING_DEFERSUBMIT = 1,
+
+    /* A kernel thread polls the submission queue, see sqpollidle and
+     * sqpollcpu. Submitting does not need a syscall while the thread is
+     * awake. */
+    CAIO_URING_SQPOLL = 2,
+
+    /* IORING_SETUP_SINGLE_ISSUER, only the creating thread submits to the
+     * ring, which is always the case for a caio loop. */
+    CAIO_URING_SINGLEISSUER = 4,
+
+    /* IORING_SETUP_DEFER_TASKRUN, completions are processed only when the
+     * loop ticks instead of interrupting the loop thread. Implies
+     * CAIO_URING_SINGLEISSUER, not compatible with CAIO_URING_SQPOLL. */
+    CAIO_URING_DEFERTASKRUN = 8,
+
+    /* IORING_SETUP_COOP_TASKRUN, the kernel does not interrupt the loop
+     * thread to post completions, they are posted at the next syscall. */
+    CAIO_URING_COOPTASKRUN = 16,
+
+    /* Register the ring fd, io_uring_enter(2) skips the fd lookup. Only the
+     * creating thread may enter the ring. */
+    CAIO_URING_REGISTERRING = 32,
+
+    /* The rings and the SQEs in huge pages of CAIO_URING_HUGEPAGE_SIZE,
+     * allocated by the module, fewer TLB misses with big rings. Needs
+     * reserved huge pages (vm.nr_hugepages) and IORING_SETUP_NO_MMAP
+     * (Linux 6.5), dropped otherwise. */
+    CAIO_URING_HUGEPAGES = 64,
+
+    /* An eventfd(2) registered with the ring is signalled on completions,
+     * see caio_uring_eventfd(). The tick only reaps, it never blocks, so an
+     * fdmon module of the same loop must watch the eventfd and do the
+     * blocking wait: caio_epoll_wakeup_watch(). Needs
+     * CAIO_URING_DEFERTASKRUN or CAIO_URING_COOPTASKRUN, otherwise the
+     * task work of the ring may interrupt that wait with EINTR, which fails
+     * the loop. The module is not created, errno EOPNOTSUPP, when neither
+     * is given or supported by the kernel. */
+    CAIO_URING_EVENTFD = 128,
+};
+
+
+#define CAIO_URING_HUGEPAGE_SIZE (2 * 1024 * 1024)
+
+
+struct caio_uring_config {
+    /* maximum in-flight jobs */
+    unsigned int jobsmax;
+    sigset_t *sigmask;
+
+    /* The flags not supported by the kernel are dropped at creation, see
+     * caio_uring_flags_get() */
+    int flags;
+
+    /* Submission and completion queue sizes, zero means jobsmax and the
+     * kernel default (twice the SQ). Multishot jobs may post many CQEs
+     * each, a bigger CQ absorbs their bursts. */
+    unsigned int sqsize;
+    unsigned int cqsize;
+
+    /* CAIO_URING_SQPOLL: milliseconds before the idle kernel thread goes to
+     * sleep (zero means the kernel default) and the CPU to pin it to
+     * (negative means no affinity) */
+    unsigned int sqpollidle;
+    int sqpollcpu;
+
+    /* Number and size of the buffers registered with the ring, leased to
+     * tasks by caio_uring_buffer_lease(), zero means no buffers */
+    unsigned int buffers;
+    size_t buffersize;
+
+    /* Size of the sparse registered file table, used by the *_direct
+     * functions, zero means no table */
+    unsigned int files;
+
+    /* caio_uring_send_zc() copies the buffers smaller than this, zero
+     * means always zero-copy */
+    size_t zcthreshold;
+
+    /* Initial size of the inbox, messages posted by the other rings wait
+     * there for the receiver, it is doubled when full. Zero means the ring
+     * does not accept messages */
+    unsigned int messages;
+};
+
+
+/* Direct descriptors are indexes of the registered file table, tagged so
+ * they can be passed where a file descriptor is expected. The all-in-one
+ * functions strip the tag and set IOSQE_FIXED_FILE. The *_direct functions
+ * complete with the bare index in cqe->res, wrap it with
+ * CAIO_URING_FIXEDFD() before use. */
+#define CAIO_URING_FIXEDFD_FLAG 0x40000000
+#define CAIO_URING_FIXEDFD(index) ((index) | CAIO_URING_FIXEDFD_FLAG)
+#define CAIO_URING_ISFIXEDFD(fd) \
+    (((fd) >= 0) && ((fd) & CAIO_URING_FIXEDFD_FLAG))
+#define CAIO_URING_FIXEDINDEX(fd) ((fd) & ~CAIO_URING_FIXEDFD_FLAG)
+
+
+/* Multishot jobs are tagged in the user_data, see
+ * caio_uring_sqe_multishot(), CAIO_URING_CQE_REARM marks the ones rearmed
+ * by the module. Their CQEs wake the task up one by one while
+ * the job is armed (IORING_CQE_F_MORE), the task must consume all the
+ * completed CQEs before awaiting again. */
+#define CAIO_URING_CQE_MULTISHOT 1ULL
+#define CAIO_URING_CQE_REARM 2ULL
+#define CAIO_URING_CQE_ZEROCOPY 4ULL
+#define CAIO_URING_CQE_TAGS (7ULL | CAIO_URING_CQE_POSITIONMASK)
+#define CAIO_URING_CQE_ISMULTISHOT(cqe) \
+    ((cqe)->user_data & CAIO_URING_CQE_MULTISHOT)
+#define CAIO_URING_CQE_HASMORE(cqe) ((cqe)->flags & IORING_CQE_F_MORE)
+
+
+/* Linked SQE chains, the position + 1 of each SQE is kept in the top byte
+ * of the user_data, so the results can be found regardless of the arrival
+ * order. The task is woken up once, when all the chain is completed, the
+ * rest of the chain is completed with -ECANCELED when a soft link fails.
+ *
+ *   struct caio_uring_chain chain;
+ *
+ *   if (caio_uring_chain_begin(&chain, u, self, 2)) ...
+ *   caio_uring_prep_read(caio_uring_chain_sqe_get(&chain, false), ...);
+ *   caio_uring_prep_write(caio_uring_chain_sqe_get(&chain, false), ...);
+ *   caio_uring_chain_submit(&chain);
+ *   CAIO_URING_AWAIT(u, self, 2);
+ *   caio_uring_chain_cqe(self, 1)->res ...
+ *   caio_uring_chain_seen(u, self);
+ */
+#define CAIO_URING_CQE_POSITIONSHIFT 56
+#define CAIO_URING_CQE_POSITIONMASK (0xFFULL << CAIO_URING_CQE_POSITIONSHIFT)
+
+
+struct caio_uring_chain {
+    struct caio_uring *uring;
+    struct caio_task *task;
+    struct io_uring_sqe *last;
+    unsigned int length;
+    unsigned int count;
+};
+
+
+/* Provided buffer id of a CQE, check CAIO_URING_CQE_HASBUFFER() first */
+#define CAIO_URING_CQE_HASBUFFER(cqe) ((cqe)->flags & IORING_CQE_F_BUFFER)
+#define CAIO_URING_CQE_BUFFER(cqe) ((cqe)->flags >> IORING_CQE_BUFFER_SHIFT)
 
 
 #define CAIO_URING_AWAIT(umod, task, taskcount) \
@@ -50,10 +262,38 @@ struct caio_uring *
 caio_uring_create(struct caio* c, unsigned int jobsmax, sigset_t *sigmask);
 
 
+struct caio_uring *
+caio_uring_create_config(struct caio* c,
+        const struct caio_uring_config *config);
+
+
 int
 caio_uring_destroy(struct caio* c, struct caio_uring *u);
 
 
+/* The fdmon interface of the ring, readiness based coroutines
+ * (CAIO_FILE_AWAIT, CAIO_FILE_TWAIT, caio_sleepA...) run on the same ring,
+ * using poll_add and linked timeouts. Not a separate module, the uring
+ * tick reaps its CQEs. */
+struct caio_fdmon *
+caio_uring_fdmon(struct caio_uring *u);
+
+
+int
+caio_uring_stats_get(struct caio_uring *u, struct caio_uring_stats *stats);
+
+
+/* The flags in effect, the ones the kernel does not support are cleared */
+int
+caio_uring_flags_get(struct caio_uring *u);
+
+
+/* The CAIO_URING_EVENTFD descriptor or -1, owned by the module. The
+ * counter is never drained, watch it edge-triggered. */
+int
+caio_uring_eventfd(struct caio_uring *u);
+
+
 int
 caio_uring_cqe_seen(struct caio_uring *u, struct caio_task *task, int index);
 
@@ -62,6 +302,89 @@ struct io_uring_sqe *
 caio_uring_sqe_get(struct caio_uring *u, struct caio_task *task);
 
 
+/* Registered buffers, returns the buffer index or -1 with ENOBUFS */
+int
+caio_uring_buffer_lease(struct caio_uring *u, void **buff);
+
+
+int
+caio_uring_buffer_release(struct caio_uring *u, int index);
+
+
+void *
+caio_uring_buffer_get(struct caio_uring *u, int index);
+
+
+size_t
+caio_uring_buffer_size(struct caio_uring *u);
+
+
+/* Registers a buffer table owned by the caller (caio_dio for instance)
+ * instead of the ring's own ones, so the config must have no buffers. The
+ * memory must stay valid until caio_uring_buffers_unregister(). Use
+ * caio_uring_sqe_get() and caio_uring_prep_read_fixed() with them, the
+ * *_fixed all-in-one functions only know the ring's own buffers. */
+int
+caio_uring_buffers_register(struct caio_uring *u, const struct iovec *iovecs,
+        unsigned int count);
+
+
+int
+caio_uring_buffers_unregister(struct caio_uring *u);
+
+
+/* Tag a SQE taken by caio_uring_sqe_get() as multishot */
+int
+caio_uring_sqe_multishot(struct caio_task *task, struct io_uring_sqe *sqe);
+
+
+/* Reserves length SQEs, so caio_uring_chain_sqe_get() never fails. */
+int
+caio_uring_chain_begin(struct caio_uring_chain *chain, struct caio_uring *u,
+        struct caio_task *task, unsigned int length);
+
+
+/* The next SQE of the chain, linked to the previous one with
+ * IOSQE_IO_HARDLINK if hard, otherwise IOSQE_IO_LINK. The link flag is set
+ * when the next SQE is taken, so the prep functions may be used freely. */
+struct io_uring_sqe *
+caio_uring_chain_sqe_get(struct caio_uring_chain *chain, bool hard);
+
+
+int
+caio_uring_chain_submit(struct caio_uring_chain *chain);
+
+
+/* The CQE of the position'th SQE of the completed chain */
+struct io_uring_cqe *
+caio_uring_chain_cqe(struct caio_task *task, unsigned int position);
+
+
+/* Mark all the chain CQEs as seen */
+int
+caio_uring_chain_seen(struct caio_uring *u, struct caio_task *task);
+
+
+/* Provided buffer ring of count (power of two) buffers in the group bgid.
+ * Buffers are only consumed when data arrives, give them back with
+ * caio_uring_bufring_release() when done. */
+struct caio_uring_bufring *
+caio_uring_bufring_create(struct caio_uring *u, int bgid, unsigned int count,
+        size_t size);
+
+
+int
+caio_uring_bufring_destroy(struct caio_uring_bufring *r);
+
+
+void *
+caio_uring_bufring_get(struct caio_uring_bufring *r, int bid);
+
+
+int
+caio_uring_bufring_release(struct caio_uring_bufring *r, int bid);
+
+
 int
 caio_uring_task_waitingjobs(struct caio_task *task);
 
@@ -70,14 +393,35 @@ int
 caio_uring_task_completed(struct caio_task *task);
 
 
+/* Releases the task's uring state, it never blocks. In-flight jobs are
+ * cancelled, the ones not completed yet are reaped by the tick later, the
+ * kernel may still use their buffers until then. Keep such buffers until
+ * the ring is destroyed, or take them from the module (bufring, leased
+ * buffers). */
 int
 caio_uring_task_cleanup(struct caio_uring *u, struct caio_task *task);
 
 
+/* Same as above, called by the loop for the terminated tasks. Also
+ * cancels the poll of caio_uring_fdmon() the task was killed waiting for,
+ * its late CQE is dropped. */
+int
+caio_uring_task_dispose(struct caio_task *task);
+
+
 struct io_uring_cqe *
 caio_uring_cqe_get(struct caio_task *task, int index);
 
 
+int
+caio_uring_submit(struct caio_uring *u);
+
+
+/* Submit the queued SQEs now, regardless of CAIO_URING_DEFERSUBMIT */
+int
+caio_uring_flush(struct caio_uring *u);
+
+
 /* all-in-one functions */
 int
 caio_uring_read(struct caio_uring *u, struct caio_task *task, int fd,
@@ -89,6 +433,19 @@ caio_uring_write(struct caio_uring *u, struct caio_task *task, int fd,
         void *buf, unsigned nbytes, __u64 offset);
 
 
+/* buf must be inside the leased buffer bufindex. All the failures are
+ * negative errnos: -EINVAL when it is not, -EBUSY when no SQE or job is
+ * free, otherwise the error of the submission. */
+int
+caio_uring_read_fixed(struct caio_uring *u, struct caio_task *task, int fd,
+        void *buf, unsigned nbytes, __u64 offset, int bufindex);
+
+
+int
+caio_uring_write_fixed(struct caio_uring *u, struct caio_task *task, int fd,
+        const void *buf, unsigned nbytes, __u64 offset, int bufindex);
+
+
 int
 caio_uring_readv(struct caio_uring *u, struct caio_task *task, int fd,
         const struct iovec *iovecs, unsigned nrvecs, __u64 offset);
@@ -109,13 +466,117 @@ caio_uring_accept(struct caio_uring *u, struct caio_task *task, int sockfd,
         struct sockaddr *addr, socklen_t *addrlen, unsigned int flags);
 
 
+/* A stream of connections, one CQE each, from a single submission. The
+ * job is rearmed by the module when the kernel terminates it without an
+ * error, so IORING_CQE_F_MORE is only cleared on errors (including
+ * -ECANCELED). At most one per task. */
 int
 caio_uring_accept_multishot(struct caio_uring *u, struct caio_task *task,
         int sockfd, struct sockaddr *addr, socklen_t *addrlen,
         unsigned int flags);
 
 
-#define caio_uring_submit(umod) io_uring_submit(&(u)->ring)
+/* Stays armed until an error, EOF or the ring runs out of buffers
+ * (-ENOBUFS), each CQE carries one buffer of r */
+int
+caio_uring_recv_multishot(struct caio_uring *u, struct caio_task *task,
+        int fd, struct caio_uring_bufring *r, int flags);
+
+
+/* Zero-copy send, the task is woken up by the result as usual, but the
+ * buffer is owned by the kernel until the notification arrives, then
+ * release(u, buf, ptr) is called by the module. It is also called for the
+ * copied (see zcthreshold) and failed sends, and by caio_uring_destroy()
+ * for the sends never notified. */
+int
+caio_uring_send_zc(struct caio_uring *u, struct caio_task *task, int fd,
+        const void *buf, size_t len, int flags, caio_uring_release release,
+        void *ptr);
+
+
+/* Direct descriptor variants, the new descriptor is allocated from the
+ * registered file table */
+int
+caio_uring_accept_direct(struct caio_uring *u, struct caio_task *task,
+        int sockfd, struct sockaddr *addr, socklen_t *addrlen,
+        unsigned int flags);
+
+
+int
+caio_uring_socket_direct(struct caio_uring *u, struct caio_task *task,
+        int domain, int type, int protocol, unsigned int flags);
+
+
+int
+caio_uring_openat_direct(struct caio_uring *u, struct caio_task *task,
+        int dfd, const char *path, int flags, mode_t mode);
+
+
+int
+caio_uring_close_direct(struct caio_uring *u, struct caio_task *task,
+        int fd);
+
+
+/* Loop to loop messages, one ring per thread. The message is posted by a
+ * job of the sender (awaited as usual, res is zero or -errno) and lands in
+ * the completion queue of the target ring, no locks and no eventfds are
+ * involved. The top two bits of data are reserved, a pointer always fits.
+ *
+ *   caio_uring_message_post(u, self, other, (uintptr_t)work, 0);
+ *   CAIO_URING_AWAIT(u, self, 1);
+ *   ...
+ *   CAIO_URING_MESSAGE_AWAIT(self, &state->message, other);
+ */
+#define CAIO_URING_MESSAGE_DATAMASK (~(3ULL << 62))
+
+
+typedef struct caio_uring_message {
+    __u64 data;
+
+    /* value of caio_uring_message_post() */
+    int value;
+
+    /* direct descriptor of caio_uring_message_postfd(), otherwise -1 */
+    int fd;
+} caio_uring_message_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY caio_uring_message
+#define CAIO_ARG1 struct caio_uring *
+#include "caio/generic.h"  // NOLINT
+
+
+int
+caio_uring_message_post(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring *target, __u64 data, int value);
+
+
+/* Transfers the direct descriptor fd of u to the file table of target, a
+ * new one is allocated there. fd stays open in u. */
+int
+caio_uring_message_postfd(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring *target, int fd, __u64 data);
+
+
+/* Pops the oldest message of the inbox, otherwise -1 with EAGAIN and the
+ * task is woken up by the next one. One receiver per ring. */
+int
+caio_uring_message_receive(struct caio_uring *u, struct caio_task *task,
+        struct caio_uring_message *msg);
+
+
+ASYNC
+caio_uring_messageA(struct caio_task *self, struct caio_uring_message *msg,
+        struct caio_uring *u);
+
+
+#define CAIO_URING_MESSAGE_AWAIT(self, msg, u) \
+    CAIO_AWAIT(self, caio_uring_message, caio_uring_messageA, msg, u)
+
+
 #define caio_uring_prep_read io_uring_prep_read
 #define caio_uring_prep_write io_uring_prep_write
 #define caio_uring_prep_readv io_uring_prep_readv
@@ -17,6 +17,8 @@
  *  Author: Vahid Mardani <vahid.mardani@gmail.com>
  */
 #include <stdio.h>
+#include <stdbool.h>
+#include <time.h>
 
 #include <clog.h>
 
@@ -27,9 +29,15 @@
 typedef struct foo {
     caio_sleep_t sleep;
     time_t delay;
+    struct timespec start;
+    bool failed;
 } foo_t;
 
 
+/* Timers never fire early, but may fire late */
+#define TOLERANCE 100
+
+
 #undef CAIO_ARG1
 #undef CAIO_ARG2
 #undef CAIO_ENTITY
@@ -50,6 +58,38 @@ static struct caio_epoll *_epoll;
 static struct caio_select *_select;
 #endif
 
+#ifdef CONFIG_CAIO_POLL
+#include "caio/poll.h"
+static struct caio_poll *_poll;
+#endif
+
+#ifdef CONFIG_CAIO_URING
+#include "caio/uring.h"
+static struct caio_uring *_uring;
+#endif
+
+
+static void
+_start(foo_t *state) {
+    clock_gettime(CLOCK_MONOTONIC, &state->start);
+}
+
+
+static void
+_check(foo_t *state) {
+    struct timespec now;
+    time_t elapsed;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - state->start.tv_sec) * 1000 +
+        (now.tv_nsec - state->start.tv_nsec) / 1000000;
+    INFO("Waited %ld miliseconds", elapsed);
+    if ((elapsed < state->delay) || (elapsed > state->delay + TOLERANCE)) {
+        ERROR("Expected %ld miliseconds", state->delay);
+        state->failed = true;
+    }
+}
+
 
 static ASYNC
 fooA(struct caio_task *self, foo_t *state) {
@@ -57,12 +97,30 @@ fooA(struct caio_task *self, foo_t *state) {
 
 #ifdef CONFIG_CAIO_EPOLL
     INFO("EPOLL: Waiting %ld miliseconds", state->delay);
+    _start(state);
     CAIO_SLEEP(self, &state->sleep, _epoll, state->delay);
+    _check(state);
 #endif
 
 #ifdef CONFIG_CAIO_SELECT
     INFO("SELECT: Waiting %ld miliseconds", state->delay);
+    _start(state);
     CAIO_SLEEP(self, &state->sleep, _select, state->delay);
+    _check(state);
+#endif
+
+#ifdef CONFIG_CAIO_POLL
+    INFO("POLL: Waiting %ld miliseconds", state->delay);
+    _start(state);
+    CAIO_SLEEP(self, &state->sleep, _poll, state->delay);
+    _check(state);
+#endif
+
+#ifdef CONFIG_CAIO_URING
+    INFO("URING: Waiting %ld miliseconds", state->delay);
+    _start(state);
+    CAIO_SLEEP(self, &state->sleep, caio_uring_fdmon(_uring), state->delay);
+    _check(state);
 #endif
 
     CAIO_FINALLY(self);
@@ -74,9 +132,14 @@ main() {
     int exitstatus = EXIT_SUCCESS;
 
     struct foo foo = {
-        .delay = 1000,
+        .delay = 1250,
     };
 
+    /* First, select(2) watches the lowest descriptors only */
+    if (caio_sleep_create(&foo.sleep)) {
+        return EXIT_FAILURE;
+    }
+
     _caio = caio_create(2);
     if (_caio == NULL) {
         exitstatus = EXIT_FAILURE;
@@ -99,14 +162,25 @@ main() {
     }
 #endif
 
-    if (caio_sleep_create(&foo.sleep)) {
+#ifdef CONFIG_CAIO_POLL
+    _poll = caio_poll_create(_caio, 1);
+    if (_poll == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+#endif
+
+#ifdef CONFIG_CAIO_URING
+    _uring = caio_uring_create(_caio, 1, NULL);
+    if (_uring == NULL) {
         exitstatus = EXIT_FAILURE;
         goto terminate;
     }
+#endif
 
     foo_spawn(_caio, fooA, &foo);
 
-    if (caio_loop(_caio)) {
+    if (caio_loop(_caio) || foo.failed) {
         exitstatus = EXIT_FAILURE;
     }
 
@@ -127,6 +201,18 @@ terminate:
     }
 #endif
 
+#ifdef CONFIG_CAIO_POLL
+    if (caio_poll_destroy(_caio, _poll)) {
+        exitstatus = EXIT_FAILURE;
+    }
+#endif
+
+#ifdef CONFIG_CAIO_URING
+    if (caio_uring_destroy(_caio, _uring)) {
+        exitstatus = EXIT_FAILURE;
+    }
+#endif
+
     if (caio_destroy(_caio)) {
         exitstatus = EXIT_FAILURE;
     }
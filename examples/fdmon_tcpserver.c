@@ -30,6 +30,7 @@
 
 #include "caio/config.h"
 #include "caio/caio.h"
+#include "caio/acceptor.h"
 
 
 #ifdef CONFIG_CAIO_EPOLL
@@ -40,6 +41,10 @@
 #include "caio/select.h"
 #endif
 
+#ifdef CONFIG_CAIO_POLL
+#include "caio/poll.h"
+#endif
+
 
 #define MAXCONN 8
 #define BUFFSIZE 1024
@@ -53,6 +58,8 @@ static struct sigaction oldaction;
 typedef struct tcpserver {
     volatile int sessions;
     struct caio_fdmon *fdmon;
+    struct caio_acceptor acceptor;
+    struct sockaddr_in bindaddr;
 } tcpserver_t;
 
 
@@ -166,13 +173,53 @@ writing:
 }
 
 
+static void *
+_conn_alloc(struct caio_acceptor *a, int fd, struct sockaddr *addr,
+        socklen_t addrlen) {
+    struct tcpserver *state = a->userdata;
+    struct tcpconn *c;
+
+    c = malloc(sizeof(struct tcpconn));
+    if (c == NULL) {
+        ERROR("Out of memory\n");
+        return NULL;
+    }
+
+    /* New Connection */
+    c->fd = fd;
+    c->localaddr = state->bindaddr;
+    c->remoteaddr = *(struct sockaddr_in *)addr;
+    c->server = state;
+    INFO("New connection from: "ADDRFMTS"", ADDRFMTV(c->remoteaddr));
+    return c;
+}
+
+
+static int
+_conn_spawn(struct caio *c, void *conn) {
+    struct tcpconn *tc = conn;
+
+    if (tcpconn_spawn(c, echoA, tc)) {
+        ERROR("Maximum connection exceeded, fd: %d\n", tc->fd);
+        return -1;
+    }
+
+    tc->server->sessions++;
+    _state_print(tc->server);
+    return 0;
+}
+
+
+static void
+_conn_release(struct caio_acceptor *a, void *conn) {
+    free(conn);
+}
+
+
 static ASYNC
 listenA(struct caio_task *self, struct tcpserver *state,
         struct sockaddr_in bindaddr, int backlog) {
-    socklen_t addrlen = sizeof(struct sockaddr);
-    struct sockaddr_in connaddr;
     static int fd;
-    int connfd;
     int res;
     int option = 1;
     CAIO_BEGIN(self);
@@ -199,43 +246,25 @@ listenA(struct caio_task *self, struct tcpserver *state,
         CAIO_THROW(self, errno);
     }
 
-    while (true) {
-        connfd = accept4(fd, (struct sockaddr * restrict)&connaddr, &addrlen,
-                SOCK_NONBLOCK);
-        if ((connfd == -1) && CAIO_MUSTWAIT(errno)) {
-            CAIO_FILE_AWAIT(state->fdmon, self, fd, CAIO_IN);
-            continue;
-        }
-
-        if (connfd == -1) {
-            ERROR("accept4\n");
-            CAIO_THROW(self, errno);
-        }
-
-        /* New Connection */
-        INFO("New connection from: "ADDRFMTS"", ADDRFMTV(connaddr));
-        struct tcpconn *c = malloc(sizeof(struct tcpconn));
-        if (c == NULL) {
-            ERROR("Out of memory\n");
-            CAIO_THROW(self, errno);
-        }
-
-        c->fd = connfd;
-        c->localaddr = bindaddr;
-        c->remoteaddr = connaddr;
-        c->server = state;
-        state->sessions++;
-        _state_print(state);
-        if (tcpconn_spawn(_caio, echoA, c)) {
-            ERROR("Maximum connection exceeded, fd: %d\n", connfd);
-            close(connfd);
-            free(c);
-        }
+    /* Drain the backlog on each wakeup */
+    state->bindaddr = bindaddr;
+    caio_acceptor_init(&state->acceptor);
+    state->acceptor.fd = fd;
+    state->acceptor.fdmon = state->fdmon;
+    state->acceptor.batch = backlog;
+    state->acceptor.policy = CAIO_ACCEPTOR_DROP;
+    state->acceptor.alloc = _conn_alloc;
+    state->acceptor.spawn = _conn_spawn;
+    state->acceptor.release = _conn_release;
+    state->acceptor.userdata = state;
+    CAIO_AWAIT(self, caio_acceptor, caio_acceptorA, &state->acceptor);
+    if (self->eno) {
+        ERROR("accept4\n");
+        CAIO_RETHROW(self);
     }
 
     CAIO_FINALLY(self);
     if (fd != -1) {
-        CAIO_FILE_FORGET(state->fdmon, fd);
         close(fd);
     }
 }
@@ -265,7 +294,7 @@ main() {
 
 #if defined(CONFIG_CAIO_EPOLL)
     struct caio_epoll *epoll;
-    epoll = caio_epoll_create(_caio, MAXCONN + 1);
+    epoll = caio_epoll_create(_caio, MAXCONN + CAIO_ACCEPTOR_FILES);
     if (epoll == NULL) {
         exitstatus = EXIT_FAILURE;
         goto terminate;
@@ -275,7 +304,7 @@ main() {
 
 #elif defined(CONFIG_CAIO_SELECT)
     struct caio_select *select;
-    select = caio_select_create(_caio, MAXCONN + 1);
+    select = caio_select_create(_caio, MAXCONN + CAIO_ACCEPTOR_FILES);
     if (select == NULL) {
         exitstatus = EXIT_FAILURE;
         goto terminate;
@@ -283,6 +312,16 @@ main() {
     state.fdmon = (struct caio_fdmon*)select;
     INFO("Using select(2) for IO monitoring.");
 
+#elif defined(CONFIG_CAIO_POLL)
+    struct caio_poll *poll;
+    poll = caio_poll_create(_caio, MAXCONN + CAIO_ACCEPTOR_FILES);
+    if (poll == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    state.fdmon = (struct caio_fdmon*)poll;
+    INFO("Using poll(2) for IO monitoring.");
+
 #endif
 
     tcpserver_spawn(_caio, listenA, &state, bindaddr, MAXCONN);
@@ -304,6 +343,12 @@ terminate:
         exitstatus = EXIT_FAILURE;
     }
 
+#elif defined(CONFIG_CAIO_POLL)
+
+    if (caio_poll_destroy(_caio, poll)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
 #endif
 
     if (caio_destroy(_caio)) {
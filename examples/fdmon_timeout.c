@@ -36,6 +36,14 @@
 #include "caio/select.h"
 #endif
 
+#ifdef CONFIG_CAIO_POLL
+#include "caio/poll.h"
+#endif
+
+#ifdef CONFIG_CAIO_URING
+#include "caio/uring.h"
+#endif
+
 
 typedef struct tmr {
     int fd;
@@ -120,7 +128,7 @@ int
 main() {
     int exitstatus = EXIT_SUCCESS;
 
-    _caio = caio_create(2);
+    _caio = caio_create(4);
     if (_caio == NULL) {
         exitstatus = EXIT_FAILURE;
         goto terminate;
@@ -162,6 +170,42 @@ main() {
     tmr_spawn(_caio, tmrA, &selecttimer);
 #endif
 
+#ifdef CONFIG_CAIO_POLL
+    struct caio_poll *poll;
+    struct tmr polltimer = {
+        .fd = -1,
+        .title = "poll",
+        .interval = 3,
+        .value = 0,
+    };
+    poll = caio_poll_create(_caio, 2);
+    if (poll == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    polltimer.fdmon = (struct caio_fdmon *)poll;
+    tmr_spawn(_caio, tmrA, &polltimer);
+#endif
+
+#ifdef CONFIG_CAIO_URING
+    struct caio_uring *uring;
+    struct tmr uringtimer = {
+        .fd = -1,
+        .title = "uring",
+        .interval = 1,
+        .value = 0,
+    };
+    uring = caio_uring_create(_caio, 2, NULL);
+    if (uring == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    uringtimer.fdmon = caio_uring_fdmon(uring);
+    tmr_spawn(_caio, tmrA, &uringtimer);
+#endif
+
     if (caio_loop(_caio)) {
         exitstatus = EXIT_FAILURE;
     }
@@ -178,6 +222,18 @@ main() {
     }
 #endif
 
+#ifdef CONFIG_CAIO_URING
+    if (caio_uring_destroy(_caio, uring)) {
+        exitstatus = EXIT_FAILURE;
+    }
+#endif
+
+#ifdef CONFIG_CAIO_POLL
+    if (caio_poll_destroy(_caio, poll)) {
+        exitstatus = EXIT_FAILURE;
+    }
+#endif
+
 terminate:
 
     if (caio_destroy(_caio)) {
@@ -0,0 +1,181 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * Worker threads produce items and wake up a caio task using caio_notify.
+ * Posts arriving while the task is busy are coalesced, so the number of
+ * wakeups is usually much smaller than the number of posts:
+ *
+ *   ./notify [WORKERS [ITEMS]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/notify.h"
+
+
+#if defined(CONFIG_CAIO_EPOLL)
+#include "caio/epoll.h"
+#elif defined(CONFIG_CAIO_POLL)
+#include "caio/poll.h"
+#elif defined(CONFIG_CAIO_SELECT)
+#include "caio/select.h"
+#endif
+
+
+typedef struct consumer {
+    struct caio_notify notify;
+    struct caio_fdmon *fdmon;
+    atomic_ulong produced;
+    unsigned long total;
+    unsigned long wakeups;
+} consumer_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY consumer
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static unsigned long _items;
+
+
+static void *
+_worker(void *arg) {
+    struct consumer *state = arg;
+    unsigned long i;
+
+    for (i = 0; i < _items; i++) {
+        atomic_fetch_add(&state->produced, 1);
+        if (caio_notify_post(&state->notify)) {
+            ERROR("caio_notify_post");
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+
+static ASYNC
+consumerA(struct caio_task *self, struct consumer *state) {
+    CAIO_BEGIN(self);
+
+    while (atomic_load(&state->produced) < state->total) {
+        CAIO_NOTIFY_AWAIT(self, &state->notify, state->fdmon);
+        state->wakeups++;
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(state->fdmon, state->notify.fd);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    unsigned int i;
+    unsigned int workers = (argc > 1)? atoi(argv[1]): 4;
+    struct caio *c = NULL;
+    pthread_t *threads = NULL;
+    struct consumer state = {
+        .fdmon = NULL,
+        .wakeups = 0,
+    };
+
+    _items = (argc > 2)? atol(argv[2]): 1000000;
+    if ((workers < 1) || (_items < 1)) {
+        ERRORH("Usage: %s [WORKERS [ITEMS]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    state.total = workers * _items;
+    atomic_init(&state.produced, 0);
+
+    if (caio_notify_create(&state.notify)) {
+        return EXIT_FAILURE;
+    }
+
+    c = caio_create(1);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+#if defined(CONFIG_CAIO_EPOLL)
+    state.fdmon = (struct caio_fdmon *)caio_epoll_create(c, 1);
+#elif defined(CONFIG_CAIO_POLL)
+    state.fdmon = (struct caio_fdmon *)caio_poll_create(c, 1);
+#elif defined(CONFIG_CAIO_SELECT)
+    state.fdmon = (struct caio_fdmon *)caio_select_create(c, 1);
+#endif
+    if (state.fdmon == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    threads = calloc(workers, sizeof(pthread_t));
+    if (threads == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    consumer_spawn(c, consumerA, &state);
+    for (i = 0; i < workers; i++) {
+        pthread_create(&threads[i], NULL, _worker, &state);
+    }
+
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+    for (i = 0; i < workers; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    INFO("posts: %lu, wakeups: %lu", state.total, state.wakeups);
+
+terminate:
+    if (state.fdmon) {
+#if defined(CONFIG_CAIO_EPOLL)
+        caio_epoll_destroy(c, (struct caio_epoll *)state.fdmon);
+#elif defined(CONFIG_CAIO_POLL)
+        caio_poll_destroy(c, (struct caio_poll *)state.fdmon);
+#elif defined(CONFIG_CAIO_SELECT)
+        caio_select_destroy(c, (struct caio_select *)state.fdmon);
+#endif
+    }
+
+    if (c) {
+        caio_destroy(c);
+    }
+
+    caio_notify_destroy(&state.notify);
+    free(threads);
+    return exitstatus;
+}
@@ -0,0 +1,536 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * TCP proxy throughput benchmark. A client thread pushes MEGABYTES through
+ * the proxy to an echo server thread and reads them back:
+ *
+ *   client <-> proxy (caio) <-> echo server
+ *
+ *   ./proxy_bench [MODE [MEGABYTES [TAP]]]
+ *
+ * MODE is one of:
+ *   - copy: read(2)/write(2) through a user-space buffer, the way the
+ *     echo examples do (default).
+ *   - splice: caio_proxy on the fdmon, splice(2) through a pipe.
+ *   - uring: caio_proxy on io_uring, linked splice SQEs.
+ *
+ * Any TAP argument mirrors the traffic into a pipe with tee(2), which is
+ * drained by another thread.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+#include "caio/proxy.h"
+
+
+#ifdef CONFIG_CAIO_EPOLL
+#include "caio/epoll.h"
+#endif
+
+#ifdef CONFIG_CAIO_SELECT
+#include "caio/select.h"
+#endif
+
+#ifdef CONFIG_CAIO_POLL
+#include "caio/poll.h"
+#endif
+
+#ifdef CONFIG_CAIO_URING
+#include "caio/uring.h"
+#endif
+
+
+#define PORT 3034
+#define UPSTREAMPORT 3035
+#define BLOCKSIZE 65536
+
+
+enum mode {
+    COPY,
+    SPLICE,
+    URING,
+};
+
+
+typedef struct copier {
+    int in;
+    int out;
+    size_t len;
+    size_t offset;
+    size_t total;
+    char buff[BLOCKSIZE];
+} copier_t;
+
+
+typedef struct listener {
+    int fd;
+    enum mode mode;
+    struct caio_fdmon *fdmon;
+#ifdef CONFIG_CAIO_URING
+    struct caio_uring *uring;
+#endif
+    int tap;
+    int client;
+    int upstream;
+    struct caio_proxy proxy;
+    struct copier copiers[2];
+} listener_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY copier
+#define CAIO_ARG1 struct caio_fdmon *
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY listener
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static struct sockaddr_in _upstreamaddr = {
+    .sin_family = AF_INET,
+    .sin_addr = {0},
+    .sin_port = 0,
+};
+static size_t _bytes;
+static struct timespec _end;
+
+
+/* The copy-based proxy, for comparison */
+static ASYNC
+copierA(struct caio_task *self, struct copier *cp, struct caio_fdmon *fdmon) {
+    ssize_t bytes;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        if (cp->offset == cp->len) {
+            bytes = read(cp->in, cp->buff, BLOCKSIZE);
+            if ((bytes == -1) && CAIO_MUSTWAIT(errno)) {
+                CAIO_FILE_AWAIT(fdmon, self, cp->in, CAIO_IN);
+                continue;
+            }
+
+            if (bytes <= 0) {
+                break;
+            }
+            cp->len = bytes;
+            cp->offset = 0;
+        }
+
+        bytes = write(cp->out, cp->buff + cp->offset, cp->len - cp->offset);
+        if ((bytes == -1) && CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(fdmon, self, cp->out, CAIO_OUT);
+            continue;
+        }
+
+        if (bytes == -1) {
+            CAIO_THROW(self, errno);
+        }
+        cp->offset += bytes;
+        cp->total += bytes;
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(fdmon, cp->in);
+    CAIO_FILE_FORGET(fdmon, cp->out);
+    shutdown(cp->out, SHUT_WR);
+}
+
+
+static int
+_copiers_spawn(struct caio *c, struct listener *l) {
+    l->copiers[0].in = l->client;
+    l->copiers[0].out = l->upstream;
+    l->copiers[1].in = dup(l->upstream);
+    l->copiers[1].out = dup(l->client);
+    if ((l->copiers[1].in == -1) || (l->copiers[1].out == -1)) {
+        return -1;
+    }
+
+    if (copier_spawn(c, copierA, &l->copiers[0], l->fdmon) ||
+            copier_spawn(c, copierA, &l->copiers[1], l->fdmon)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static ASYNC
+listenerA(struct caio_task *self, struct listener *l) {
+    CAIO_BEGIN(self);
+
+    /* One connection */
+    while (true) {
+        l->client = accept4(l->fd, NULL, NULL, SOCK_NONBLOCK);
+        if ((l->client == -1) && CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(l->fdmon, self, l->fd, CAIO_IN);
+            continue;
+        }
+        break;
+    }
+    CAIO_FILE_FORGET(l->fdmon, l->fd);
+
+    if (l->client == -1) {
+        CAIO_THROW(self, errno);
+    }
+
+    /* The echo server is listening already */
+    l->upstream = socket(AF_INET, SOCK_STREAM, 0);
+    if ((l->upstream == -1) || connect(l->upstream,
+                (struct sockaddr *)&_upstreamaddr, sizeof(_upstreamaddr)) ||
+            fcntl(l->upstream, F_SETFL, O_NONBLOCK)) {
+        CAIO_THROW(self, errno);
+    }
+
+    if (l->mode == COPY) {
+        if (_copiers_spawn(self->caio, l)) {
+            CAIO_THROW(self, errno);
+        }
+        CAIO_RETURN(self);
+    }
+
+    if (caio_proxy_create(&l->proxy, l->client, l->upstream, 0)) {
+        CAIO_THROW(self, errno);
+    }
+    l->proxy.flows[0].tap = l->tap;
+    l->proxy.flows[1].tap = l->tap;
+
+#ifdef CONFIG_CAIO_URING
+    if (l->mode == URING) {
+        if (caio_proxy_uring_spawn(self->caio, &l->proxy, l->uring)) {
+            CAIO_THROW(self, errno);
+        }
+        CAIO_RETURN(self);
+    }
+#endif
+
+    if (caio_proxy_spawn(self->caio, &l->proxy, l->fdmon)) {
+        CAIO_THROW(self, errno);
+    }
+
+    CAIO_FINALLY(self);
+}
+
+
+static int
+_listen(int port) {
+    int fd;
+    int option = 1;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(port),
+    };
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 1)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/* Blocking echo server, one connection */
+static void *
+_upstream(void *arg) {
+    int listenfd = *(int *)arg;
+    int fd;
+    char *buff = malloc(BLOCKSIZE);
+    ssize_t bytes;
+    struct pollfd pfd = {listenfd, POLLIN, 0};
+
+    poll(&pfd, 1, -1);
+    fd = accept(listenfd, NULL, NULL);
+    while ((fd != -1) && ((bytes = read(fd, buff, BLOCKSIZE)) > 0)) {
+        if (write(fd, buff, bytes) != bytes) {
+            break;
+        }
+    }
+
+    close(fd);
+    free(buff);
+    return NULL;
+}
+
+
+static void *
+_client_writer(void *arg) {
+    int fd = *(int *)arg;
+    char *buff = calloc(1, BLOCKSIZE);
+    size_t written = 0;
+    ssize_t bytes;
+
+    while (written < _bytes) {
+        bytes = write(fd, buff, BLOCKSIZE);
+        if (bytes <= 0) {
+            break;
+        }
+        written += bytes;
+    }
+
+    shutdown(fd, SHUT_WR);
+    free(buff);
+    return NULL;
+}
+
+
+static void *
+_client_reader(void *arg) {
+    int fd = *(int *)arg;
+    char *buff = malloc(BLOCKSIZE);
+    size_t total = 0;
+    ssize_t bytes;
+
+    while ((bytes = read(fd, buff, BLOCKSIZE)) > 0) {
+        total += bytes;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &_end);
+    if (total != _bytes) {
+        ERROR("Received %lu bytes instead of %lu", total, _bytes);
+    }
+
+    free(buff);
+    return NULL;
+}
+
+
+static void *
+_tap_drain(void *arg) {
+    int fd = *(int *)arg;
+    char *buff = malloc(BLOCKSIZE);
+
+    while (read(fd, buff, BLOCKSIZE) > 0) {
+    }
+
+    free(buff);
+    return NULL;
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    const char *modename = (argc > 1)? argv[1]: "copy";
+    unsigned long megabytes = (argc > 2)? atol(argv[2]): 1024;
+    bool tap = argc > 3;
+    struct caio *c = NULL;
+    struct listener listener;
+    int upstreamfd = -1;
+    int client = -1;
+    int tappipe[2] = {-1, -1};
+    pthread_t upstreamthread;
+    pthread_t writerthread;
+    pthread_t readerthread;
+    pthread_t tapthread;
+    struct timespec start;
+    double seconds;
+    struct sockaddr_in proxyaddr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+
+    memset(&listener, 0, sizeof(listener));
+    listener.fd = -1;
+    listener.client = -1;
+    listener.upstream = -1;
+    listener.tap = -1;
+    listener.copiers[1].in = -1;
+    if (strcmp(modename, "copy") == 0) {
+        listener.mode = COPY;
+    }
+    else if (strcmp(modename, "splice") == 0) {
+        listener.mode = SPLICE;
+    }
+#ifdef CONFIG_CAIO_URING
+    else if (strcmp(modename, "uring") == 0) {
+        listener.mode = URING;
+    }
+#endif
+    else {
+        ERRORH("Usage: %s [copy|splice|uring [MEGABYTES [TAP]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    _bytes = megabytes * 1024 * 1024;
+
+    /* The proxy splices into sockets which may be closed */
+    signal(SIGPIPE, SIG_IGN);
+
+    c = caio_create(4);
+    if (c == NULL) {
+        return EXIT_FAILURE;
+    }
+
+#if defined(CONFIG_CAIO_EPOLL)
+    listener.fdmon = (struct caio_fdmon *)caio_epoll_create(c, 4);
+#elif defined(CONFIG_CAIO_SELECT)
+    listener.fdmon = (struct caio_fdmon *)caio_select_create(c, 4);
+#elif defined(CONFIG_CAIO_POLL)
+    listener.fdmon = (struct caio_fdmon *)caio_poll_create(c, 4);
+#endif
+#ifdef CONFIG_CAIO_URING
+    listener.uring = caio_uring_create(c, 16, NULL);
+    if (listener.uring == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+#endif
+    if (listener.fdmon == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    listener.fd = _listen(PORT);
+    upstreamfd = _listen(UPSTREAMPORT);
+    if ((listener.fd == -1) || (upstreamfd == -1)) {
+        ERROR("Cannot listen");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    _upstreamaddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    _upstreamaddr.sin_port = htons(UPSTREAMPORT);
+
+    if (tap) {
+        if (pipe2(tappipe, O_CLOEXEC)) {
+            exitstatus = EXIT_FAILURE;
+            goto terminate;
+        }
+        listener.tap = tappipe[1];
+        pthread_create(&tapthread, NULL, _tap_drain, &tappipe[0]);
+    }
+
+    client = socket(AF_INET, SOCK_STREAM, 0);
+    if ((client == -1) || connect(client, (struct sockaddr *)&proxyaddr,
+                sizeof(proxyaddr))) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    listener_spawn(c, listenerA, &listener);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pthread_create(&upstreamthread, NULL, _upstream, &upstreamfd);
+    pthread_create(&writerthread, NULL, _client_writer, &client);
+    pthread_create(&readerthread, NULL, _client_reader, &client);
+
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+    pthread_join(writerthread, NULL);
+    pthread_join(readerthread, NULL);
+    pthread_join(upstreamthread, NULL);
+
+    seconds = (_end.tv_sec - start.tv_sec) +
+        (_end.tv_nsec - start.tv_nsec) / 1e9;
+    INFO("mode: %s, %lu MB echoed in %.2f seconds, %.1f MB/s", modename,
+            megabytes, seconds, megabytes / seconds);
+    if (tap) {
+        INFO("tap: %lu bytes mirrored, %lu bytes dropped",
+                listener.proxy.flows[0].tapped +
+                listener.proxy.flows[1].tapped,
+                listener.proxy.flows[0].tapdropped +
+                listener.proxy.flows[1].tapdropped);
+        close(tappipe[1]);
+        tappipe[1] = -1;
+        pthread_join(tapthread, NULL);
+    }
+
+terminate:
+    if (listener.mode == COPY) {
+        if (listener.copiers[1].in != -1) {
+            close(listener.copiers[1].in);
+            close(listener.copiers[1].out);
+        }
+    }
+    else if (listener.proxy.flows[0].proxy) {
+        caio_proxy_destroy(&listener.proxy);
+    }
+
+    if (listener.client != -1) {
+        close(listener.client);
+        close(listener.upstream);
+    }
+
+    if (client != -1) {
+        close(client);
+    }
+
+    if (tappipe[0] != -1) {
+        close(tappipe[0]);
+        if (tappipe[1] != -1) {
+            close(tappipe[1]);
+        }
+    }
+
+    if (listener.fd != -1) {
+        close(listener.fd);
+    }
+
+    if (upstreamfd != -1) {
+        close(upstreamfd);
+    }
+
+#ifdef CONFIG_CAIO_URING
+    if (listener.uring) {
+        caio_uring_destroy(c, listener.uring);
+    }
+#endif
+
+#if defined(CONFIG_CAIO_EPOLL)
+    caio_epoll_destroy(c, (struct caio_epoll *)listener.fdmon);
+#elif defined(CONFIG_CAIO_SELECT)
+    caio_select_destroy(c, (struct caio_select *)listener.fdmon);
+#elif defined(CONFIG_CAIO_POLL)
+    caio_poll_destroy(c, (struct caio_poll *)listener.fdmon);
+#endif
+    caio_destroy(c);
+    return exitstatus;
+}
@@ -0,0 +1,345 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * Sharded echo server benchmark, N caio loops on N threads each with its own
+ * SO_REUSEPORT listener. Built-in blocking clients open, echo and close
+ * connections as fast as they can and the connections per second is
+ * reported at the end:
+ *
+ *   ./shard_echobench [SHARDS [CLIENTS [SECONDS]]]
+ *
+ * Run it with 1, 2, 4... shards and the same number of clients to see the
+ * scaling.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+#include "caio/shard.h"
+#include "caio/acceptor.h"
+
+
+#ifdef CONFIG_CAIO_EPOLL
+#include "caio/epoll.h"
+#endif
+
+#ifdef CONFIG_CAIO_SELECT
+#include "caio/select.h"
+#endif
+
+#ifdef CONFIG_CAIO_POLL
+#include "caio/poll.h"
+#endif
+
+
+#define PORT 3030
+#define MAXCONN 256
+#define BUFFSIZE 1024
+#define MESSAGE "Hello caio!"
+
+
+static struct caio_shards *_shards;
+static atomic_bool _clients_stop = false;
+static atomic_bool _interrupted = false;
+
+
+/* Per loop state */
+typedef struct shardstate {
+    struct caio_shard *shard;
+    struct caio_fdmon *fdmon;
+    struct caio_acceptor acceptor;
+} shardstate_t;
+
+
+typedef struct tcpconn {
+    int fd;
+    char buff[BUFFSIZE];
+    struct shardstate *shardstate;
+} tcpconn_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY tcpconn
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static void
+_sighandler(int s) {
+    atomic_store(&_interrupted, true);
+}
+
+
+static ASYNC
+echoA(struct caio_task *self, struct tcpconn *conn) {
+    ssize_t bytes;
+    struct caio_fdmon *fdmon = conn->shardstate->fdmon;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        bytes = read(conn->fd, conn->buff, BUFFSIZE);
+        if ((bytes == -1) && CAIO_MUSTWAIT(errno)) {
+            CAIO_FILE_AWAIT(fdmon, self, conn->fd, CAIO_IN);
+            continue;
+        }
+
+        if (bytes <= 0) {
+            break;
+        }
+
+        /* Messages are small enough to fit in the socket buffer */
+        if (write(conn->fd, conn->buff, bytes) != bytes) {
+            break;
+        }
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(fdmon, conn->fd);
+    close(conn->fd);
+    free(conn);
+}
+
+
+static void *
+_conn_alloc(struct caio_acceptor *a, int fd, struct sockaddr *addr,
+        socklen_t addrlen) {
+    struct tcpconn *conn = malloc(sizeof(struct tcpconn));
+
+    if (conn == NULL) {
+        return NULL;
+    }
+
+    conn->fd = fd;
+    conn->shardstate = a->userdata;
+    return conn;
+}
+
+
+static int
+_conn_spawn(struct caio *c, void *conn) {
+    return tcpconn_spawn(c, echoA, conn);
+}
+
+
+static void
+_conn_release(struct caio_acceptor *a, void *conn) {
+    free(conn);
+}
+
+
+static int
+_shard_setup(struct caio_shard *shard) {
+    struct shardstate *state = shard->state;
+
+    state->shard = shard;
+#if defined(CONFIG_CAIO_EPOLL)
+    state->fdmon = (struct caio_fdmon*)caio_epoll_create(shard->caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#elif defined(CONFIG_CAIO_SELECT)
+    state->fdmon = (struct caio_fdmon*)caio_select_create(shard->caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#elif defined(CONFIG_CAIO_POLL)
+    state->fdmon = (struct caio_fdmon*)caio_poll_create(shard->caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#endif
+    if (state->fdmon == NULL) {
+        return -1;
+    }
+
+    caio_acceptor_init(&state->acceptor);
+    state->acceptor.fd = shard->listenfd;
+    state->acceptor.fdmon = state->fdmon;
+    state->acceptor.batch = MAXCONN;
+    state->acceptor.policy = CAIO_ACCEPTOR_DROP;
+    state->acceptor.alloc = _conn_alloc;
+    state->acceptor.spawn = _conn_spawn;
+    state->acceptor.release = _conn_release;
+    state->acceptor.userdata = state;
+    return caio_acceptor_spawn(shard->caio, caio_acceptorA, &state->acceptor);
+}
+
+
+static int
+_shard_teardown(struct caio_shard *shard) {
+    struct shardstate *state = shard->state;
+
+#if defined(CONFIG_CAIO_EPOLL)
+    return caio_epoll_destroy(shard->caio, (struct caio_epoll*)state->fdmon);
+#elif defined(CONFIG_CAIO_SELECT)
+    return caio_select_destroy(shard->caio,
+            (struct caio_select*)state->fdmon);
+#elif defined(CONFIG_CAIO_POLL)
+    return caio_poll_destroy(shard->caio, (struct caio_poll*)state->fdmon);
+#endif
+}
+
+
+static void *
+_client(void *arg) {
+    unsigned long *count = arg;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+    struct linger linger = {1, 0};
+    char buff[sizeof(MESSAGE)];
+    int fd;
+
+    while (!atomic_load(&_clients_stop)) {
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd == -1) {
+            break;
+        }
+
+        /* Reset instead of TIME_WAIT, so ports are not exhausted */
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &linger, sizeof(linger));
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            close(fd);
+            usleep(1000);
+            continue;
+        }
+
+        if ((write(fd, MESSAGE, sizeof(MESSAGE)) == sizeof(MESSAGE)) &&
+                (read(fd, buff, sizeof(buff)) == sizeof(MESSAGE))) {
+            (*count)++;
+        }
+        close(fd);
+    }
+
+    return NULL;
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    unsigned int i;
+    unsigned int shards = (argc > 1)? atoi(argv[1]): 0;
+    unsigned int clients = (argc > 2)? atoi(argv[2]): 1;
+    unsigned int seconds = (argc > 3)? atoi(argv[3]): 5;
+    unsigned int elapsed = 0;
+    unsigned long total = 0;
+    struct sockaddr_in bindaddr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+    struct caio_shard_config config = {
+        .count = shards,
+        .maxtasks = MAXCONN + 1,
+        .bindaddr = (struct sockaddr *)&bindaddr,
+        .bindaddrlen = sizeof(bindaddr),
+        .backlog = MAXCONN,
+        .flags = CAIO_SHARD_PINCPU,
+        .setup = _shard_setup,
+        .teardown = _shard_teardown,
+    };
+    struct sigaction action = {{_sighandler}, {{0, 0, 0, 0}}};
+    struct shardstate *states = NULL;
+    unsigned long *counts = NULL;
+    pthread_t *threads = NULL;
+
+    if (clients < 1) {
+        ERRORH("Usage: %s [SHARDS [CLIENTS [SECONDS]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    _shards = caio_shards_create(&config);
+    if (_shards == NULL) {
+        return EXIT_FAILURE;
+    }
+    shards = caio_shards_count(_shards);
+
+    states = calloc(shards, sizeof(struct shardstate));
+    counts = calloc(clients, sizeof(unsigned long));
+    threads = calloc(clients, sizeof(pthread_t));
+    if ((states == NULL) || (counts == NULL) || (threads == NULL)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    for (i = 0; i < shards; i++) {
+        caio_shards_get(_shards, i)->state = &states[i];
+    }
+
+    if (sigaction(SIGINT, &action, NULL)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    if (caio_shards_start(_shards)) {
+        ERROR("Cannot start shards");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    INFO("Listening on: tcp://127.0.0.1:%d, shards: %u, clients: %u, "
+            "seconds: %u", PORT, shards, clients, seconds);
+
+    for (i = 0; i < clients; i++) {
+        pthread_create(&threads[i], NULL, _client, &counts[i]);
+    }
+
+    /* Ctrl-C only stops the wait, the loops are killed below as usual */
+    while ((elapsed < seconds) && (!atomic_load(&_interrupted))) {
+        sleep(1);
+        elapsed++;
+    }
+    atomic_store(&_clients_stop, true);
+    for (i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        total += counts[i];
+    }
+
+    caio_shards_killall(_shards);
+    if (caio_shards_join(_shards)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+    for (i = 0; i < shards; i++) {
+        INFO("shard #%u accepted: %lu, dropped: %lu, batches: %lu, "
+                "max batch: %u", i, states[i].acceptor.accepted,
+                states[i].acceptor.dropped, states[i].acceptor.batches,
+                states[i].acceptor.maxbatch);
+    }
+    INFO("total: %lu connections, %lu conn/s", total,
+            total / (elapsed? elapsed: 1));
+
+terminate:
+    caio_shards_destroy(_shards);
+    free(states);
+    free(counts);
+    free(threads);
+    return exitstatus;
+}
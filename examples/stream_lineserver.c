@@ -0,0 +1,247 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * Line based echo server using caio_stream. Pipelined requests are read
+ * with a single syscall and their replies are sent back together:
+ *
+ *   printf 'foo\nbar\nbaz\n' | nc localhost 3031
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/acceptor.h"
+#include "caio/stream.h"
+
+
+#if defined(CONFIG_CAIO_EPOLL)
+#include "caio/epoll.h"
+#elif defined(CONFIG_CAIO_POLL)
+#include "caio/poll.h"
+#elif defined(CONFIG_CAIO_SELECT)
+#include "caio/select.h"
+#endif
+
+
+#define PORT 3031
+#define MAXCONN 16
+#define LINESIZE 256
+
+
+static struct caio *_caio;
+static struct caio_fdmon *_fdmon;
+
+
+typedef struct session {
+    struct caio_stream stream;
+    unsigned long lines;
+    char line[LINESIZE];
+} session_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY session
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static void
+_sighandler(int s) {
+    caio_task_killall(_caio);
+}
+
+
+static bool
+_linebuffered(struct session *s) {
+    size_t len = caio_stream_peek(&s->stream, s->line, LINESIZE);
+    return memchr(s->line, '\n', len) != NULL;
+}
+
+
+static ASYNC
+sessionA(struct caio_task *self, struct session *s) {
+    size_t len;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        CAIO_STREAM_READUNTIL(self, &s->stream, "\n", 1);
+        if (self->eno) {
+            CAIO_RETHROW(self);
+        }
+
+        len = caio_stream_consume(&s->stream, s->line, s->stream.found);
+        s->lines++;
+        CAIO_STREAM_WRITE(self, &s->stream, s->line, len);
+        if (self->eno) {
+            CAIO_RETHROW(self);
+        }
+
+        /* Replies of pipelined requests share one writev(2) */
+        if (_linebuffered(s)) {
+            continue;
+        }
+
+        CAIO_STREAM_FLUSH(self, &s->stream);
+        if (self->eno) {
+            CAIO_RETHROW(self);
+        }
+    }
+
+    CAIO_FINALLY(self);
+    if ((self->eno != ENODATA) && (self->eno != 0)) {
+        ERROR("session(fd: %d)", s->stream.fd);
+    }
+    INFO("fd: %d closed after %lu line(s)", s->stream.fd, s->lines);
+    CAIO_FILE_FORGET(_fdmon, s->stream.fd);
+    close(s->stream.fd);
+    caio_stream_destroy(&s->stream);
+    free(s);
+}
+
+
+static void *
+_session_alloc(struct caio_acceptor *a, int fd, struct sockaddr *addr,
+        socklen_t addrlen) {
+    struct session *s = malloc(sizeof(struct session));
+
+    if (s == NULL) {
+        return NULL;
+    }
+
+    if (caio_stream_create(&s->stream, fd, _fdmon, LINESIZE * 4,
+                LINESIZE * 4)) {
+        free(s);
+        return NULL;
+    }
+
+    s->lines = 0;
+    return s;
+}
+
+
+static int
+_session_spawn(struct caio *c, void *conn) {
+    return session_spawn(c, sessionA, conn);
+}
+
+
+static void
+_session_release(struct caio_acceptor *a, void *conn) {
+    struct session *s = conn;
+
+    caio_stream_destroy(&s->stream);
+    free(s);
+}
+
+
+int
+main() {
+    int exitstatus = EXIT_SUCCESS;
+    struct sigaction action = {{_sighandler}, {{0, 0, 0, 0}}};
+    struct sockaddr_in bindaddr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_ANY)},
+        .sin_port = htons(PORT),
+    };
+    struct caio_acceptor acceptor;
+    int option = 1;
+
+    caio_acceptor_init(&acceptor);
+    acceptor.batch = MAXCONN;
+    acceptor.policy = CAIO_ACCEPTOR_DROP;
+    acceptor.alloc = _session_alloc;
+    acceptor.spawn = _session_spawn;
+    acceptor.release = _session_release;
+
+    if (sigaction(SIGINT, &action, NULL)) {
+        return EXIT_FAILURE;
+    }
+
+    _caio = caio_create(MAXCONN + 1);
+    if (_caio == NULL) {
+        return EXIT_FAILURE;
+    }
+
+#if defined(CONFIG_CAIO_EPOLL)
+    _fdmon = (struct caio_fdmon *)caio_epoll_create(_caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#elif defined(CONFIG_CAIO_POLL)
+    _fdmon = (struct caio_fdmon *)caio_poll_create(_caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#elif defined(CONFIG_CAIO_SELECT)
+    _fdmon = (struct caio_fdmon *)caio_select_create(_caio,
+            MAXCONN + CAIO_ACCEPTOR_FILES);
+#endif
+    if (_fdmon == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    acceptor.fdmon = _fdmon;
+    acceptor.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (acceptor.fd == -1) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    setsockopt(acceptor.fd, SOL_SOCKET, SO_REUSEADDR, &option,
+            sizeof(option));
+    if (bind(acceptor.fd, (struct sockaddr *)&bindaddr, sizeof(bindaddr)) ||
+            listen(acceptor.fd, MAXCONN)) {
+        ERROR("Cannot listen on port: %d", PORT);
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    INFO("Listening on: tcp://0.0.0.0:%d", PORT);
+
+    caio_acceptor_spawn(_caio, caio_acceptorA, &acceptor);
+    if (caio_loop(_caio)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+terminate:
+    if (acceptor.fd != -1) {
+        close(acceptor.fd);
+    }
+
+    if (_fdmon) {
+#if defined(CONFIG_CAIO_EPOLL)
+        caio_epoll_destroy(_caio, (struct caio_epoll *)_fdmon);
+#elif defined(CONFIG_CAIO_POLL)
+        caio_poll_destroy(_caio, (struct caio_poll *)_fdmon);
+#elif defined(CONFIG_CAIO_SELECT)
+        caio_select_destroy(_caio, (struct caio_select *)_fdmon);
+#endif
+    }
+
+    caio_destroy(_caio);
+    return exitstatus;
+}
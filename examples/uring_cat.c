@@ -17,29 +17,27 @@
  *  Author: Vahid Mardani <vahid.mardani@gmail.com>
  *
  *
- * An io_uring(7) example of cat
+ * An io_uring(7) example of cat, each file is streamed to the stdout by
+ * caio_filecopy, DEPTH blocks of BLOCKSIZE bytes in flight, so the memory
+ * usage does not depend on the file sizes.
  */
 #include <stdio.h>
 #include <string.h>
-#include <sys/ioctl.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <clog.h>
 
 #include "caio/config.h"
 #include "caio/caio.h"
 #include "caio/uring.h"
+#include "caio/filecopy.h"
 
 
-#define MAXTASKS 1
-#define CHUNKSIZE 1024
-
-
-struct fileinfo {
-    int fd;
-    off_t size;
-    int blocks;
-    struct iovec iovecs[];
-};
+#define BLOCKSIZE (64 * 1024)
+#define DEPTH 4
+#define MAXTASKS (DEPTH + 1)
+#define MAXJOBS (DEPTH * 2 + 1)
 
 
 static struct caio *_caio;
@@ -49,7 +47,10 @@ static struct sigaction oldaction;
 typedef struct cat {
     int argc;
     const char **argv;
+    int index;
+    off_t outpos;
     struct caio_uring *uring;
+    struct caio_filecopy copy;
 } cat_t;
 
 
@@ -80,158 +81,38 @@ _handlesignals() {
 }
 
 
-/*
-* Returns the size of the file whose open file descriptor is passed in.
-* Properly handles regular file and block devices as well. Pretty.
-* */
-static off_t
-_filesize_get(int fd) {
-    struct stat st;
-
-    if (fstat(fd, &st) < 0) {
-        perror("fstat");
-        return -1;
-    }
-
-    if (S_ISBLK(st.st_mode)) {
-        unsigned long long bytes;
-        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) {
-            perror("ioctl");
-            return -1;
-        }
-        return bytes;
-    } else if (S_ISREG(st.st_mode))
-        return st.st_size;
-
-    return -1;
-}
-
-
-void
-_fileinfo_dispose(struct fileinfo *info) {
-    if (info == NULL) {
-        return;
-    }
-
-    int i = info->blocks;
-    while (--i >= 0) {
-        free(info->iovecs[i].iov_base);
-    }
-
-    free(info);
-}
-
-
-static struct fileinfo *
-_fileinfo_create(const char *filename) {
-    int fd = open(filename, O_RDONLY);
-    if (fd < 0) {
-        perror("open");
-        return NULL;
-    }
-    off_t filesize = _filesize_get(fd);
-    off_t remaining = filesize;
-    off_t offset = 0;
-    int i = 0;
-    int blocks = (int) filesize / CHUNKSIZE;
-    if (filesize % CHUNKSIZE) {
-        blocks++;
-    }
-
-    struct fileinfo *info = malloc(sizeof(struct fileinfo) +
-            sizeof(struct iovec) * blocks);
-    if (info == NULL) {
-        perror("out of memory");
-        return NULL;
-    }
-
-    while (remaining) {
-        off_t toread = remaining;
-        if (toread > CHUNKSIZE) {
-            toread = CHUNKSIZE;
-        }
-
-        offset += toread;
-        info->iovecs[i].iov_len = toread;
-        void *buf;
-        if (posix_memalign(&buf, CHUNKSIZE, CHUNKSIZE)) {
-            perror("posix_memalign");
-            goto failed;
-        }
-        info->iovecs[i].iov_base = buf;
-
-        i++;
-        remaining -= toread;
-    }
-    info->size = filesize;
-    info->blocks = blocks;
-    info->fd = fd;
-    return info;
-
-failed:
-    _fileinfo_dispose(info);
-
-    return NULL;
-}
-
-
 static ASYNC
 catA(struct caio_task *self, struct cat *state) {
-    int ret;
-    static int i;
-    static struct fileinfo *info;
+    int fd;
     CAIO_BEGIN(self);
 
-    for (i = 1; i < state->argc; i++) {
-        /* open, get filesize and allocate buffer */
-        info = _fileinfo_create(state->argv[i]);
-        if (info == NULL) {
-            perror("create file info");
-            CAIO_THROW(self, errno);
-        }
+    /* Where a regular stdout is written */
+    state->outpos = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+    if (state->outpos == -1) {
+        state->outpos = 0;
+    }
 
-        /* create, setup and submit a sqe for read the file into buffer
-         */
-        ret = caio_uring_readv(
-                state->uring,
-                self,
-                info->fd,
-                info->iovecs,
-                info->blocks,
-                0);
-        if (ret < 0) {
-            perror("io_uring readv submit.");
-            CAIO_THROW(self, -ret);
+    for (state->index = 1; state->index < state->argc; state->index++) {
+        fd = open(state->argv[state->index], O_RDONLY);
+        if (fd < 0) {
+            perror("open");
+            CAIO_THROW(self, errno);
         }
 
-        /* wait for task to complete */
-        CAIO_URING_AWAIT(state->uring, self, 1);
-        caio_uring_cqe_seen(state->uring, self, 0);
-
-        /* close the file descriptor. */
-        close(info->fd);
-
-        /* create, setup and submit a sqe to write into stdout from the buffer
-         */
-        ret = caio_uring_writev(
-                state->uring,
-                self,
-                STDOUT_FILENO,
-                info->iovecs,
-                info->blocks,
-                0);
-        if (ret < 0) {
-            perror("io_uring task submit.");
-            CAIO_THROW(self, -ret);
+        memset(&state->copy, 0, sizeof(struct caio_filecopy));
+        state->copy.infd = fd;
+        state->copy.outfd = STDOUT_FILENO;
+        state->copy.outoffset = state->outpos;
+        state->copy.blocksize = BLOCKSIZE;
+        state->copy.depth = DEPTH;
+        CAIO_FILECOPY_AWAIT(self, &state->copy, state->uring);
+        close(state->copy.infd);
+        if (CAIO_HASERROR(self)) {
+            errno = self->eno;
+            perror("io_uring copy");
+            CAIO_RETHROW(self);
         }
-
-        /* wait for task to complete */
-        CAIO_URING_AWAIT(state->uring, self, 1);
-        caio_uring_cqe_seen(state->uring, self, 0);
-
-        /* cleanup */
-        fsync(STDOUT_FILENO);
-        _fileinfo_dispose(info);
+        state->outpos += state->copy.copied;
     }
 
     CAIO_FINALLY(self);
@@ -264,7 +145,7 @@ main(int argc, const char **argv) {
     }
 
     /* Initialize io_uring */
-    state.uring = caio_uring_create(_caio, MAXTASKS, NULL);
+    state.uring = caio_uring_create(_caio, MAXJOBS, NULL);
     if (state.uring == NULL) {
         perror("io_uring setup failed!");
         exitstatus = EXIT_FAILURE;
@@ -0,0 +1,194 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * io_uring(7) file copy using linked SQE chains. Each block is read and
+ * written by a read -> write chain and the last chain ends with an fsync,
+ * so the task wakes up once per block:
+ *
+ *   ./uring_copy SOURCE DESTINATION
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+#define BLOCKSIZE 65536
+
+
+typedef struct copy {
+    struct caio_uring *uring;
+    int infd;
+    int outfd;
+    off_t size;
+    off_t offset;
+
+    /* current block, coroutine locals do not survive the await */
+    unsigned int bytes;
+    char buff[BLOCKSIZE];
+} copy_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY copy
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static ASYNC
+copyA(struct caio_task *self, struct copy *c) {
+    struct caio_uring_chain chain;
+    struct io_uring_sqe *sqe;
+    unsigned int length;
+    unsigned int i;
+    int res;
+    CAIO_BEGIN(self);
+
+    while (c->offset < c->size) {
+        c->bytes = c->size - c->offset;
+        if (c->bytes > BLOCKSIZE) {
+            c->bytes = BLOCKSIZE;
+        }
+
+        /* read -> write, and -> fsync for the last block */
+        length = ((c->offset + c->bytes) == c->size)? 3: 2;
+        if (caio_uring_chain_begin(&chain, c->uring, self, length)) {
+            CAIO_THROW(self, errno);
+        }
+
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_read(sqe, c->infd, c->buff, c->bytes, c->offset);
+        sqe = caio_uring_chain_sqe_get(&chain, false);
+        caio_uring_prep_write(sqe, c->outfd, c->buff, c->bytes, c->offset);
+        if (length == 3) {
+            sqe = caio_uring_chain_sqe_get(&chain, false);
+            caio_uring_prep_fsync(sqe, c->outfd, 0);
+        }
+
+        res = caio_uring_chain_submit(&chain);
+        if (res < 0) {
+            CAIO_THROW(self, -res);
+        }
+
+        /* one wakeup for the whole chain */
+        CAIO_URING_AWAIT(c->uring, self, length);
+
+        /* a failed link cancels the rest of the chain */
+        length = caio_uring_task_completed(self);
+        for (i = 0; i < length; i++) {
+            res = caio_uring_chain_cqe(self, i)->res;
+            if ((res >= 0) && (i < 2) && (res != (int)c->bytes)) {
+                /* the file is changed under us */
+                res = -EIO;
+            }
+
+            if (res < 0) {
+                ERROR("chain position: %u", i);
+                caio_uring_chain_seen(c->uring, self);
+                CAIO_THROW(self, -res);
+            }
+        }
+        caio_uring_chain_seen(c->uring, self);
+        c->offset += c->bytes;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(c->uring, self);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    struct caio *c = NULL;
+    struct stat st;
+    struct copy *copy;
+
+    if (argc != 3) {
+        ERRORH("Usage: %s SOURCE DESTINATION\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    copy = malloc(sizeof(struct copy));
+    if (copy == NULL) {
+        return EXIT_FAILURE;
+    }
+    copy->offset = 0;
+    copy->uring = NULL;
+    copy->outfd = -1;
+    copy->infd = open(argv[1], O_RDONLY);
+    if ((copy->infd == -1) || fstat(copy->infd, &st)) {
+        ERROR("open: %s", argv[1]);
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    copy->size = st.st_size;
+
+    copy->outfd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (copy->outfd == -1) {
+        ERROR("open: %s", argv[2]);
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    c = caio_create(1);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    copy->uring = caio_uring_create(c, 4, NULL);
+    if (copy->uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    copy_spawn(c, copyA, copy);
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+terminate:
+    if (c) {
+        caio_uring_destroy(c, copy->uring);
+        if (caio_destroy(c)) {
+            exitstatus = EXIT_FAILURE;
+        }
+    }
+    if (copy->infd != -1) {
+        close(copy->infd);
+    }
+    if (copy->outfd != -1) {
+        close(copy->outfd);
+    }
+    free(copy);
+    return exitstatus;
+}
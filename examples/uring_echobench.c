@@ -0,0 +1,358 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * io_uring(7) loopback echo benchmark. CLIENTS blocking client threads
+ * connect and ping-pong ROUNDS small messages each, the server side runs on
+ * a single caio loop and reports the round trips per second:
+ *
+ *   ./uring_echobench [MODE [CLIENTS [ROUNDS]]]
+ *
+ * MODE is one of:
+ *   - normal: connections are accepted as regular file descriptors
+ *     (default).
+ *   - direct: connections are accepted into the registered file table and
+ *     all reads and writes use IOSQE_FIXED_FILE, which saves the per-op file
+ *     table lookup and reference counting.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+#define PORT 3032
+#define BUFFSIZE 64
+#define MESSAGE "Hello caio!"
+
+
+typedef struct echoserver {
+    struct caio_uring *uring;
+    int listenfd;
+    bool direct;
+    unsigned int clients;
+} echoserver_t;
+
+
+typedef struct echoconn {
+    int fd;
+    char buff[BUFFSIZE];
+    struct echoserver *server;
+} echoconn_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY echoserver
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY echoconn
+#include "caio/generic.h"  // NOLINT
+#include "caio/generic.c"  // NOLINT
+
+
+static unsigned long _rounds;
+
+
+static ASYNC
+echoA(struct caio_task *self, struct echoconn *conn) {
+    int ret;
+    struct caio_uring *u = conn->server->uring;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        /* conn->fd may be a direct descriptor */
+        ret = caio_uring_read(u, self, conn->fd, conn->buff, BUFFSIZE, 0);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+        CAIO_URING_AWAIT(u, self, 1);
+        ret = caio_uring_cqe_get(self, 0)->res;
+        caio_uring_cqe_seen(u, self, 0);
+        if (ret <= 0) {
+            break;
+        }
+
+        ret = caio_uring_write(u, self, conn->fd, conn->buff, ret, 0);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+        CAIO_URING_AWAIT(u, self, 1);
+        ret = caio_uring_cqe_get(self, 0)->res;
+        caio_uring_cqe_seen(u, self, 0);
+        if (ret <= 0) {
+            break;
+        }
+    }
+
+    /* Direct descriptors are not visible to close(2) */
+    if (CAIO_URING_ISFIXEDFD(conn->fd)) {
+        ret = caio_uring_close_direct(u, self, conn->fd);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+        CAIO_URING_AWAIT(u, self, 1);
+        caio_uring_cqe_seen(u, self, 0);
+        conn->fd = -1;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(u, self);
+    if (self->eno) {
+        ERROR("echo(fd: %d)", conn->fd);
+    }
+    if ((conn->fd != -1) && !CAIO_URING_ISFIXEDFD(conn->fd)) {
+        close(conn->fd);
+    }
+    free(conn);
+}
+
+
+static ASYNC
+listenA(struct caio_task *self, struct echoserver *server) {
+    int ret;
+    struct echoconn *conn;
+    CAIO_BEGIN(self);
+
+    while (server->clients) {
+        if (server->direct) {
+            ret = caio_uring_accept_direct(server->uring, self,
+                    server->listenfd, NULL, NULL, 0);
+        }
+        else {
+            ret = caio_uring_accept(server->uring, self, server->listenfd,
+                    NULL, NULL, 0);
+        }
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+
+        CAIO_URING_AWAIT(server->uring, self, 1);
+        ret = caio_uring_cqe_get(self, 0)->res;
+        caio_uring_cqe_seen(server->uring, self, 0);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+
+        conn = malloc(sizeof(struct echoconn));
+        if (conn == NULL) {
+            CAIO_THROW(self, ENOMEM);
+        }
+
+        /* The direct variant completes with the file table index */
+        conn->fd = server->direct? CAIO_URING_FIXEDFD(ret): ret;
+        conn->server = server;
+        if (echoconn_spawn(self->caio, echoA, conn)) {
+            free(conn);
+            CAIO_THROW(self, ENOMEM);
+        }
+        server->clients--;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(server->uring, self);
+    if (self->eno) {
+        ERROR("accept");
+    }
+}
+
+
+static void *
+_client(void *arg) {
+    unsigned long *rounds = arg;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+    char buff[sizeof(MESSAGE)];
+    unsigned long i;
+    int option = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &option, sizeof(option));
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(fd);
+        return NULL;
+    }
+
+    for (i = 0; i < _rounds; i++) {
+        if ((write(fd, MESSAGE, sizeof(MESSAGE)) != sizeof(MESSAGE)) ||
+                (read(fd, buff, sizeof(buff)) != sizeof(MESSAGE))) {
+            break;
+        }
+        (*rounds)++;
+    }
+
+    close(fd);
+    return NULL;
+}
+
+
+static int
+_listen() {
+    int fd;
+    int option = 1;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1) {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(fd, SOMAXCONN)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    const char *mode = (argc > 1)? argv[1]: "normal";
+    unsigned int clients = (argc > 2)? atoi(argv[2]): 4;
+    unsigned int i;
+    unsigned long total = 0;
+    unsigned long *counts = NULL;
+    pthread_t *threads = NULL;
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    struct caio *c = NULL;
+    struct caio_uring_stats stats;
+    struct caio_uring_config config = {
+        .sqpollcpu = -1,
+    };
+    struct echoserver server = {
+        .listenfd = -1,
+        .clients = clients,
+    };
+
+    _rounds = (argc > 3)? atol(argv[3]): 20000;
+    if (strcmp(mode, "direct") == 0) {
+        server.direct = true;
+    }
+    else if (strcmp(mode, "normal")) {
+        ERRORH("Usage: %s [normal|direct [CLIENTS [ROUNDS]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (clients < 1) {
+        ERRORH("Invalid clients: %u\n", clients);
+        return EXIT_FAILURE;
+    }
+
+    server.listenfd = _listen();
+    if (server.listenfd == -1) {
+        ERROR("Cannot listen on port: %d", PORT);
+        return EXIT_FAILURE;
+    }
+
+    counts = calloc(clients, sizeof(unsigned long));
+    threads = calloc(clients, sizeof(pthread_t));
+    if ((counts == NULL) || (threads == NULL)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    c = caio_create(clients + 1);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    config.jobsmax = clients + 1;
+    config.files = server.direct? clients: 0;
+    server.uring = caio_uring_create_config(c, &config);
+    if (server.uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    echoserver_spawn(c, listenA, &server);
+    for (i = 0; i < clients; i++) {
+        pthread_create(&threads[i], NULL, _client, &counts[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        total += counts[i];
+    }
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    caio_uring_stats_get(server.uring, &stats);
+    INFO("mode: %s, clients: %u, round trips: %lu, seconds: %.3f, "
+            "rtt/s: %.0f, cqes: %lu, ticks: %lu", mode, clients, total,
+            elapsed, total / elapsed, stats.cqes, stats.ticks);
+
+terminate:
+    if (c) {
+        caio_uring_destroy(c, server.uring);
+        if (caio_destroy(c)) {
+            exitstatus = EXIT_FAILURE;
+        }
+    }
+    free(counts);
+    free(threads);
+    if (server.listenfd != -1) {
+        close(server.listenfd);
+    }
+    return exitstatus;
+}
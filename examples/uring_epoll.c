@@ -0,0 +1,281 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * A loop with both caio_epoll and caio_uring. A task waits on a pipe with
+ * epoll (a socket of a third party library in real life) while another one
+ * reads timestamps from a second pipe with io_uring. The delay between the
+ * write and the wakeup of the uring task is reported at the end:
+ *
+ *   ./uring_epoll [ROUNDS [MODE]]
+ *
+ * The ring uses CAIO_URING_DEFERTASKRUN, so the completions do not
+ * interrupt the thread, MODE is one of:
+ *   - eventfd: CAIO_URING_EVENTFD, watched by the epoll module, the
+ *     completions wake up the epoll_wait(2) (default).
+ *   - plain: each module waits on its own, the completions wait for the
+ *     epoll_wait(2) timeout.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/fdmon.h"
+#include "caio/epoll.h"
+#include "caio/uring.h"
+
+
+#define INTERVAL_US 2000
+
+
+typedef struct reader {
+    struct caio_uring *uring;
+    int fd;
+    int stopfd;
+    struct timespec sent;
+    unsigned long count;
+    double total_us;
+    double max_us;
+} reader_t;
+
+
+typedef struct waiter {
+    struct caio_fdmon *fdmon;
+    int fd;
+} waiter_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY reader
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY waiter
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static unsigned long _rounds;
+
+
+static double
+_elapsed_us(const struct timespec *since) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1e6 +
+        (now.tv_nsec - since->tv_nsec) / 1e3;
+}
+
+
+/* Writes a timestamp every INTERVAL_US, then closes the pipe */
+static void *
+_writer(void *arg) {
+    int fd = *(int *)arg;
+    struct timespec now;
+    unsigned long i;
+
+    for (i = 0; i < _rounds; i++) {
+        usleep(INTERVAL_US);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (write(fd, &now, sizeof(now)) != sizeof(now)) {
+            break;
+        }
+    }
+
+    close(fd);
+    return NULL;
+}
+
+
+static ASYNC
+readerA(struct caio_task *self, struct reader *state) {
+    int ret;
+    double latency;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        ret = caio_uring_read(state->uring, self, state->fd, &state->sent,
+                sizeof(state->sent), -1);
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+
+        CAIO_URING_AWAIT(state->uring, self, 1);
+        ret = caio_uring_cqe_get(self, 0)->res;
+        caio_uring_cqe_seen(state->uring, self, 0);
+        if (ret != sizeof(state->sent)) {
+            break;
+        }
+
+        latency = _elapsed_us(&state->sent);
+        state->total_us += latency;
+        if (latency > state->max_us) {
+            state->max_us = latency;
+        }
+        state->count++;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(state->uring, self);
+
+    /* Let the epoll side go too */
+    if (write(state->stopfd, "", 1) != 1) {
+        ERROR("write");
+    }
+}
+
+
+static ASYNC
+waiterA(struct caio_task *self, struct waiter *state) {
+    char c;
+    CAIO_BEGIN(self);
+
+    while (read(state->fd, &c, 1) == -1) {
+        if (!CAIO_MUSTWAIT(errno)) {
+            CAIO_THROW(self, errno);
+        }
+        CAIO_FILE_AWAIT(state->fdmon, self, state->fd, CAIO_IN);
+    }
+
+    CAIO_FINALLY(self);
+    CAIO_FILE_FORGET(state->fdmon, state->fd);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    const char *mode = (argc > 2)? argv[2]: "eventfd";
+    struct caio_uring_config config = {
+        .jobsmax = 4,
+        .flags = CAIO_URING_DEFERTASKRUN,
+        .sqpollcpu = -1,
+    };
+    struct caio *c = NULL;
+    struct caio_epoll *epoll = NULL;
+    struct caio_uring *uring = NULL;
+    struct reader reader;
+    struct waiter waiter;
+    int data[2] = {-1, -1};
+    int stop[2] = {-1, -1};
+    pthread_t thread;
+    bool started = false;
+
+    _rounds = (argc > 1)? atol(argv[1]): 1000;
+    if (_rounds == 0) {
+        ERRORH("Usage: %s [ROUNDS [MODE]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(mode, "eventfd") == 0) {
+        config.flags |= CAIO_URING_EVENTFD;
+    }
+    else if (strcmp(mode, "plain")) {
+        ERRORH("Invalid mode: %s\n", mode);
+        return EXIT_FAILURE;
+    }
+
+    if (pipe(data) || pipe2(stop, O_NONBLOCK)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    c = caio_create(2);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    epoll = caio_epoll_create(c, 2);
+    uring = caio_uring_create_config(c, &config);
+    if ((epoll == NULL) || (uring == NULL)) {
+        ERROR("Cannot create the modules");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    if ((caio_uring_eventfd(uring) != -1) &&
+            caio_epoll_wakeup_watch(epoll, caio_uring_eventfd(uring))) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    memset(&reader, 0, sizeof(reader));
+    reader.uring = uring;
+    reader.fd = data[0];
+    reader.stopfd = stop[1];
+    waiter.fdmon = (struct caio_fdmon *)epoll;
+    waiter.fd = stop[0];
+    reader_spawn(c, readerA, &reader);
+    waiter_spawn(c, waiterA, &waiter);
+
+    if (pthread_create(&thread, NULL, _writer, &data[1])) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+    started = true;
+
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+    INFO("mode: %s, rounds: %lu, avg latency: %.1f us, max: %.1f us", mode,
+            reader.count, reader.count? reader.total_us / reader.count: 0,
+            reader.max_us);
+
+terminate:
+    if (started) {
+        pthread_join(thread, NULL);
+    }
+    else if (data[1] != -1) {
+        close(data[1]);
+    }
+
+    if (uring) {
+        caio_uring_destroy(c, uring);
+    }
+
+    if (epoll) {
+        caio_epoll_destroy(c, epoll);
+    }
+
+    if (c) {
+        caio_destroy(c);
+    }
+
+    close(data[0]);
+    close(stop[0]);
+    close(stop[1]);
+    return exitstatus;
+}
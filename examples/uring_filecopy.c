@@ -0,0 +1,143 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * Pipelined io_uring(7) file copy benchmark, DEPTH blocks of BLOCKSIZE KiB
+ * are in flight, reads of some blocks overlap the writes of the others. The
+ * throughput is reported at the end:
+ *
+ *   ./uring_filecopy SOURCE DESTINATION [BLOCKSIZE [DEPTH]]
+ *
+ * Compare DEPTH 1 (the same as uring_copy) with 4, 8... DESTINATION may be
+ * /dev/null or - for the stdout, to measure the read side only.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+#include "caio/filecopy.h"
+
+
+static struct caio *_caio;
+
+
+static void
+_sighandler(int s) {
+    caio_task_killall(_caio);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    struct caio_uring *uring = NULL;
+    struct caio_filecopy copy;
+    struct sigaction action = {{_sighandler}, {{0, 0, 0, 0}}};
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    unsigned int blocksize = (argc > 3)? atoi(argv[3]): 128;
+    unsigned int depth = (argc > 4)? atoi(argv[4]): 4;
+
+    if ((argc < 3) || (blocksize == 0) || (depth == 0)) {
+        ERRORH("Usage: %s SOURCE DESTINATION [BLOCKSIZE [DEPTH]]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    memset(&copy, 0, sizeof(copy));
+    copy.blocksize = blocksize * 1024;
+    copy.depth = depth;
+    copy.outfd = -1;
+    copy.infd = open(argv[1], O_RDONLY);
+    if (copy.infd == -1) {
+        ERROR("open: %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(argv[2], "-") == 0) {
+        copy.outfd = dup(STDOUT_FILENO);
+    }
+    else {
+        copy.outfd = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        copy.flags = CAIO_FILECOPY_FSYNC;
+    }
+
+    if (copy.outfd == -1) {
+        ERROR("open: %s", argv[2]);
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    if (sigaction(SIGINT, &action, NULL)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    _caio = caio_create(depth + 1);
+    if (_caio == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    uring = caio_uring_create(_caio, depth * 2 + 1, NULL);
+    if (uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    caio_filecopy_spawn(_caio, caio_filecopyA, &copy, uring);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (caio_loop(_caio)) {
+        exitstatus = EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    INFO("blocksize: %uK, depth: %u, copied: %ld bytes, %.3f s, %.1f MB/s",
+            blocksize, depth, (long)copy.copied, seconds,
+            copy.copied / seconds / 1e6);
+    if (copy.eno || (copy.copied != copy.length)) {
+        ERROR("incomplete copy: %s", strerror(copy.eno? copy.eno: EIO));
+        exitstatus = EXIT_FAILURE;
+    }
+
+terminate:
+    if (_caio) {
+        caio_uring_destroy(_caio, uring);
+        if (caio_destroy(_caio)) {
+            exitstatus = EXIT_FAILURE;
+        }
+    }
+    close(copy.infd);
+    if (copy.outfd != -1) {
+        close(copy.outfd);
+    }
+    return exitstatus;
+}
@@ -0,0 +1,301 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * Cross-loop messaging benchmark, a sender loop posts MESSAGES messages to
+ * a receiver loop on another thread, DEPTH at a time:
+ *
+ *   ./uring_msgbench [MESSAGES [DEPTH [MODE]]]
+ *
+ * MODE is one of:
+ *   - data: the payload only (default).
+ *   - fd: each message also transfers a direct descriptor, which the
+ *     receiver closes.
+ *
+ * The messages per second and the per-message cost are reported at the
+ * end. Messages rejected because the receiver is behind are posted again.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+#define INBOXSIZE 256
+#define FILES 4096
+
+
+typedef struct sender {
+    struct caio_uring *uring;
+    struct caio_uring *target;
+    unsigned long count;
+    unsigned int depth;
+    unsigned int batch;
+    bool fd;
+    int socket;
+    unsigned long sent;
+    unsigned long retries;
+} sender_t;
+
+
+typedef struct receiver {
+    struct caio_uring *uring;
+    unsigned long count;
+    unsigned long received;
+    struct caio_uring_message message;
+} receiver_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY sender
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY receiver
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static ASYNC
+senderA(struct caio_task *self, struct sender *state) {
+    struct io_uring_cqe *cqe;
+    unsigned int i;
+    int ret;
+    CAIO_BEGIN(self);
+
+    /* The descriptor transferred by all the messages */
+    if (state->fd) {
+        if (caio_uring_socket_direct(state->uring, self, AF_INET,
+                    SOCK_DGRAM, 0, 0) < 0) {
+            CAIO_THROW(self, errno);
+        }
+        CAIO_URING_AWAIT(state->uring, self, 1);
+        cqe = caio_uring_cqe_get(self, 0);
+        if (cqe->res < 0) {
+            CAIO_THROW(self, -cqe->res);
+        }
+        state->socket = CAIO_URING_FIXEDFD(cqe->res);
+        caio_uring_cqe_seen(state->uring, self, 0);
+    }
+
+    while (state->sent < state->count) {
+        state->batch = state->count - state->sent;
+        if (state->batch > state->depth) {
+            state->batch = state->depth;
+        }
+
+        for (i = 0; i < state->batch; i++) {
+            if (state->fd) {
+                ret = caio_uring_message_postfd(state->uring, self,
+                        state->target, state->socket, state->sent + i);
+            }
+            else {
+                ret = caio_uring_message_post(state->uring, self,
+                        state->target, state->sent + i, 0);
+            }
+
+            if (ret < 0) {
+                CAIO_THROW(self, errno);
+            }
+        }
+
+        CAIO_URING_AWAIT(state->uring, self, state->batch);
+        for (i = 0; i < state->batch; i++) {
+            cqe = caio_uring_cqe_get(self, i);
+            if (cqe->res >= 0) {
+                state->sent++;
+            }
+            else if ((cqe->res == -EOVERFLOW) || (cqe->res == -ENFILE)) {
+                /* The receiver is behind */
+                state->retries++;
+            }
+            else {
+                CAIO_THROW(self, -cqe->res);
+            }
+            caio_uring_cqe_seen(state->uring, self, i);
+        }
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(state->uring, self);
+}
+
+
+static ASYNC
+receiverA(struct caio_task *self, struct receiver *state) {
+    CAIO_BEGIN(self);
+
+    while (state->received < state->count) {
+        CAIO_URING_MESSAGE_AWAIT(self, &state->message, state->uring);
+        state->received++;
+        if (state->message.fd == -1) {
+            continue;
+        }
+
+        if (caio_uring_close_direct(state->uring, self,
+                    state->message.fd) < 0) {
+            CAIO_THROW(self, errno);
+        }
+        CAIO_URING_AWAIT(state->uring, self, 1);
+        caio_uring_cqe_seen(state->uring, self, 0);
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(state->uring, self);
+}
+
+
+static void *
+_receiver_main(void *arg) {
+    struct caio *c = arg;
+
+    if (caio_loop(c)) {
+        ERROR("Receiver loop failed");
+    }
+
+    return NULL;
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    unsigned long messages = (argc > 1)? atol(argv[1]): 1000000;
+    unsigned int depth = (argc > 2)? atoi(argv[2]): 8;
+    const char *mode = (argc > 3)? argv[3]: "data";
+    struct caio_uring_config config = {
+        .sigmask = NULL,
+        .flags = 0,
+        .sqpollcpu = -1,
+    };
+    struct caio *senderloop = NULL;
+    struct caio *receiverloop = NULL;
+    struct caio_uring *senderring = NULL;
+    struct caio_uring *receiverring = NULL;
+    struct sender sender;
+    struct receiver receiver;
+    struct caio_uring_stats stats;
+    struct timespec start;
+    struct timespec end;
+    pthread_t thread;
+    double seconds;
+
+    if ((messages < 1) || (depth < 1) ||
+            (depth > CONFIG_CAIO_URING_TASK_MAXWAITING)) {
+        ERRORH("Usage: %s [MESSAGES [DEPTH [MODE]]], DEPTH <= %d\n",
+                argv[0], CONFIG_CAIO_URING_TASK_MAXWAITING);
+        return EXIT_FAILURE;
+    }
+
+    memset(&sender, 0, sizeof(sender));
+    memset(&receiver, 0, sizeof(receiver));
+    if (strcmp(mode, "fd") == 0) {
+        sender.fd = true;
+        config.files = FILES;
+    }
+    else if (strcmp(mode, "data")) {
+        ERRORH("Invalid mode: %s\n", mode);
+        return EXIT_FAILURE;
+    }
+
+    senderloop = caio_create(1);
+    receiverloop = caio_create(1);
+    if ((senderloop == NULL) || (receiverloop == NULL)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    config.jobsmax = depth;
+    senderring = caio_uring_create_config(senderloop, &config);
+    config.jobsmax = 1;
+    config.messages = INBOXSIZE;
+    receiverring = caio_uring_create_config(receiverloop, &config);
+    if ((senderring == NULL) || (receiverring == NULL)) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    sender.uring = senderring;
+    sender.target = receiverring;
+    sender.count = messages;
+    sender.depth = depth;
+    sender_spawn(senderloop, senderA, &sender);
+
+    receiver.uring = receiverring;
+    receiver.count = messages;
+    receiver_spawn(receiverloop, receiverA, &receiver);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (pthread_create(&thread, NULL, _receiver_main, receiverloop)) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    if (caio_loop(senderloop)) {
+        exitstatus = EXIT_FAILURE;
+    }
+
+    /* Nothing more is coming if the sender failed */
+    if (sender.sent < messages) {
+        caio_task_killall(receiverloop);
+    }
+    pthread_join(thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    INFO("mode: %s, depth: %u, messages: %lu, %.0f msg/s, %.0f ns/msg",
+            mode, depth, receiver.received, receiver.received / seconds,
+            receiver.received? seconds * 1e9 / receiver.received: 0);
+    caio_uring_stats_get(senderring, &stats);
+    INFO("sender: posted: %lu, retries: %lu, submit syscalls: %lu",
+            stats.posted, sender.retries, stats.submits);
+    caio_uring_stats_get(receiverring, &stats);
+    INFO("receiver: received: %lu, ticks: %lu, avg batch: %.1f",
+            stats.received, stats.ticks,
+            stats.ticks? (double)stats.cqes / stats.ticks: 0);
+
+terminate:
+    if (senderring) {
+        caio_uring_destroy(senderloop, senderring);
+    }
+
+    if (receiverring) {
+        caio_uring_destroy(receiverloop, receiverring);
+    }
+    caio_destroy(senderloop);
+    caio_destroy(receiverloop);
+    return exitstatus;
+}
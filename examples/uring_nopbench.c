@@ -0,0 +1,252 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ * io_uring(7) round trip benchmark. TASKS tasks each submit DEPTH nop(s),
+ * wait for all of them and repeat, until ROUNDS rounds are done:
+ *
+ *   ./uring_nopbench [TASKS [DEPTH [ROUNDS [MODE [RINGSIZE]]]]]
+ *
+ * MODE is one of:
+ *   - now: each task submits its own SQEs (default).
+ *   - defer: CAIO_URING_DEFERSUBMIT, the loop submits once per tick.
+ *   - sqpoll: CAIO_URING_SQPOLL, a kernel thread polls the submissions.
+ *   - single: CAIO_URING_DEFERTASKRUN and CAIO_URING_REGISTERRING, the
+ *     single issuer setup, completions are processed only by the ticks.
+ *   - coop: CAIO_URING_COOPTASKRUN and CAIO_URING_REGISTERRING.
+ *   - huge: CAIO_URING_HUGEPAGES, the rings in huge pages. Reserve some
+ *     first: sysctl vm.nr_hugepages=8. Compare with now at high queue
+ *     depths, e.g. 4096 tasks of depth 8.
+ *
+ * RINGSIZE sets both the SQ and the CQ sizes, the default is
+ * TASKS * DEPTH. A ring smaller than that overflows the CQ, see the health
+ * counters.
+ *
+ * The number of CQEs reaped per loop tick and the number of submit
+ * syscalls are reported at the end, with the flags the kernel accepted and
+ * the user space dTLB misses, when perf_event_open(2) is permitted.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+typedef struct nopper {
+    struct caio_uring *uring;
+    unsigned int depth;
+    unsigned long rounds;
+    unsigned long done;
+} nopper_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY nopper
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+/* User space dTLB load misses of this thread, -1 if not permitted */
+static int
+_tlbmisses_open() {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+
+static ASYNC
+nopperA(struct caio_task *self, struct nopper *state) {
+    struct io_uring_sqe *sqe;
+    unsigned int i;
+    CAIO_BEGIN(self);
+
+    while (state->done < state->rounds) {
+        for (i = 0; i < state->depth; i++) {
+            sqe = caio_uring_sqe_get(state->uring, self);
+            if (sqe == NULL) {
+                CAIO_THROW(self, ENOMEM);
+            }
+            caio_uring_prep_nop(sqe);
+        }
+        caio_uring_submit(state->uring);
+
+        CAIO_URING_AWAIT(state->uring, self, state->depth);
+        for (i = 0; i < state->depth; i++) {
+            if (caio_uring_cqe_get(self, i)->res < 0) {
+                CAIO_THROW(self, -caio_uring_cqe_get(self, i)->res);
+            }
+            caio_uring_cqe_seen(state->uring, self, i);
+        }
+        state->done++;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(state->uring, self);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    unsigned int i;
+    unsigned int tasks = (argc > 1)? atoi(argv[1]): 64;
+    unsigned int depth = (argc > 2)? atoi(argv[2]): 4;
+    unsigned long rounds = (argc > 3)? atol(argv[3]): 10000;
+    const char *mode = (argc > 4)? argv[4]: "now";
+    unsigned int ringsize = (argc > 5)? atoi(argv[5]): 0;
+    struct caio_uring_config config = {
+        .sigmask = NULL,
+        .flags = 0,
+        .sqpollidle = 1000,
+        .sqpollcpu = -1,
+    };
+    struct caio *c = NULL;
+    struct caio_uring *uring = NULL;
+    struct caio_uring_stats stats;
+    struct nopper *states = NULL;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    unsigned long ops;
+    long long tlbmisses = -1;
+    int perffd;
+
+    if ((tasks < 1) || (depth < 1) ||
+            (depth > CONFIG_CAIO_URING_TASK_MAXWAITING)) {
+        ERRORH("Usage: %s [TASKS [DEPTH [ROUNDS [MODE [RINGSIZE]]]]], "
+                "DEPTH <= %d\n",
+                argv[0], CONFIG_CAIO_URING_TASK_MAXWAITING);
+        return EXIT_FAILURE;
+    }
+
+    config.jobsmax = tasks * depth;
+    config.sqsize = ringsize;
+    config.cqsize = ringsize;
+    if (strcmp(mode, "defer") == 0) {
+        config.flags |= CAIO_URING_DEFERSUBMIT;
+    }
+    else if (strcmp(mode, "sqpoll") == 0) {
+        config.flags |= CAIO_URING_SQPOLL;
+    }
+    else if (strcmp(mode, "single") == 0) {
+        config.flags |= CAIO_URING_DEFERTASKRUN | CAIO_URING_REGISTERRING;
+    }
+    else if (strcmp(mode, "coop") == 0) {
+        config.flags |= CAIO_URING_COOPTASKRUN | CAIO_URING_REGISTERRING;
+    }
+    else if (strcmp(mode, "huge") == 0) {
+        config.flags |= CAIO_URING_HUGEPAGES;
+    }
+    else if (strcmp(mode, "now")) {
+        ERRORH("Invalid mode: %s\n", mode);
+        return EXIT_FAILURE;
+    }
+
+    c = caio_create(tasks);
+    if (c == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    uring = caio_uring_create_config(c, &config);
+    if (uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    states = calloc(tasks, sizeof(struct nopper));
+    if (states == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    for (i = 0; i < tasks; i++) {
+        states[i].uring = uring;
+        states[i].depth = depth;
+        states[i].rounds = rounds;
+        nopper_spawn(c, nopperA, &states[i]);
+    }
+
+    perffd = _tlbmisses_open();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (perffd != -1) {
+        if (read(perffd, &tlbmisses, sizeof(tlbmisses)) !=
+                sizeof(tlbmisses)) {
+            tlbmisses = -1;
+        }
+        close(perffd);
+    }
+
+    ops = 0;
+    for (i = 0; i < tasks; i++) {
+        ops += states[i].done * depth;
+    }
+    seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    caio_uring_stats_get(uring, &stats);
+    INFO("mode: %s, flags: 0x%x (requested 0x%x), tasks: %u, depth: %u, "
+            "ops: %lu, %.0f ops/s", mode, caio_uring_flags_get(uring),
+            config.flags, tasks, depth, ops, ops / seconds);
+    INFO("ticks: %lu, cqes: %lu, avg batch: %.1f, max batch: %u",
+            stats.ticks, stats.cqes,
+            stats.ticks? (double)stats.cqes / stats.ticks: 0,
+            stats.maxbatch);
+    INFO("submit syscalls: %lu, sqes: %lu, wait syscalls: %lu",
+            stats.submits, stats.submitted, stats.waits);
+    INFO("in-flight max: %u, max submit: %u, sq full: %lu, cq overflows: "
+            "%lu, cq dropped: %lu, busy: %lu", stats.maxinflight,
+            stats.maxsubmit, stats.sqfull, stats.cqoverflows,
+            stats.cqdropped, stats.busy);
+    if (tlbmisses >= 0) {
+        INFO("dTLB load misses: %lld, %.3f per op", tlbmisses,
+                ops? (double)tlbmisses / ops: 0);
+    }
+
+terminate:
+    if (uring) {
+        caio_uring_destroy(c, uring);
+    }
+    caio_destroy(c);
+    free(states);
+    return exitstatus;
+}
@@ -0,0 +1,331 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ * io_uring(7) file read benchmark. TASKS tasks read the file in BLOCKSIZE
+ * chunks until PASSES passes are done:
+ *
+ *   ./uring_readbench FILENAME [MODE [TASKS [BLOCKSIZE [PASSES]]]]
+ *
+ * MODE is one of:
+ *   - normal: plain read into malloc(3)ed buffers (default).
+ *   - fixed: read_fixed into the buffers registered with the ring.
+ *   - direct: O_DIRECT, plain read into the caio_dio aligned buffers.
+ *   - directfixed: O_DIRECT, read_fixed into the caio_dio buffers registered
+ *     with the ring.
+ *
+ * BLOCKSIZE must be a multiple of the direct I/O alignment of the file in
+ * the direct modes. Compare normal and direct on a file bigger than the
+ * page cache, or drop the caches before each run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+#ifdef CONFIG_CAIO_DIO
+#include "caio/dio.h"
+#endif
+
+
+typedef struct bench {
+    struct caio_uring *uring;
+    int fd;
+    bool fixed;
+#ifdef CONFIG_CAIO_DIO
+    struct caio_dio *dio;
+#endif
+    off_t size;
+    size_t blocksize;
+    unsigned int passes;
+    off_t offset;
+    unsigned int pass;
+    unsigned long bytes;
+} bench_t;
+
+
+typedef struct reader {
+    struct bench *bench;
+    void *buff;
+    int bufindex;
+} reader_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY reader
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+/* Next block offset of the file, -1 when all passes are done */
+static off_t
+_nextblock(struct bench *b) {
+    off_t offset;
+
+    if (b->offset >= b->size) {
+        if (++b->pass >= b->passes) {
+            return -1;
+        }
+        b->offset = 0;
+    }
+
+    offset = b->offset;
+    b->offset += b->blocksize;
+    return offset;
+}
+
+
+static ASYNC
+readerA(struct caio_task *self, struct reader *r) {
+    struct bench *b = r->bench;
+    off_t offset;
+    int ret;
+    int res;
+    CAIO_BEGIN(self);
+
+    while (true) {
+        offset = _nextblock(b);
+        if (offset == -1) {
+            break;
+        }
+
+#ifdef CONFIG_CAIO_DIO
+        if (b->dio) {
+            ret = caio_dio_read(b->dio, self, b->fd, r->buff, b->blocksize,
+                    offset);
+        }
+        else
+#endif
+        if (b->fixed) {
+            ret = caio_uring_read_fixed(b->uring, self, b->fd, r->buff,
+                    b->blocksize, offset, r->bufindex);
+        }
+        else {
+            ret = caio_uring_read(b->uring, self, b->fd, r->buff,
+                    b->blocksize, offset);
+        }
+
+        if (ret < 0) {
+            CAIO_THROW(self, -ret);
+        }
+
+        CAIO_URING_AWAIT(b->uring, self, 1);
+        res = caio_uring_cqe_get(self, 0)->res;
+        caio_uring_cqe_seen(b->uring, self, 0);
+        if (res < 0) {
+            CAIO_THROW(self, -res);
+        }
+        b->bytes += res;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(b->uring, self);
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    unsigned int i;
+    const char *mode = (argc > 2)? argv[2]: "normal";
+    unsigned int tasks = (argc > 3)? atoi(argv[3]): 8;
+    struct caio *c = NULL;
+    struct reader *readers = NULL;
+    struct stat st;
+    struct timespec start;
+    struct timespec end;
+    double seconds;
+    int oflags = O_RDONLY;
+#ifdef CONFIG_CAIO_DIO
+    bool direct = false;
+    int dioflags = 0;
+    size_t align;
+#endif
+    struct bench bench = {
+        .fd = -1,
+        .blocksize = (argc > 4)? atoi(argv[4]): 64 * 1024,
+        .passes = (argc > 5)? atoi(argv[5]): 10,
+    };
+    struct caio_uring_config config = {
+        .sigmask = NULL,
+        .flags = 0,
+        .sqpollcpu = -1,
+    };
+
+    if ((argc < 2) || (tasks < 1) || (bench.blocksize < 1) ||
+            (bench.passes < 1)) {
+        ERRORH("Usage: %s FILENAME [MODE [TASKS [BLOCKSIZE [PASSES]]]]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (strcmp(mode, "fixed") == 0) {
+        bench.fixed = true;
+        config.buffers = tasks;
+        config.buffersize = bench.blocksize;
+    }
+#ifdef CONFIG_CAIO_DIO
+    else if (strcmp(mode, "direct") == 0) {
+        direct = true;
+        oflags |= O_DIRECT;
+    }
+    else if (strcmp(mode, "directfixed") == 0) {
+        direct = true;
+        dioflags = CAIO_DIO_REGISTER;
+        oflags |= O_DIRECT;
+    }
+#endif
+    else if (strcmp(mode, "normal")) {
+        ERRORH("Invalid mode: %s\n", mode);
+        return EXIT_FAILURE;
+    }
+    config.jobsmax = tasks;
+
+    bench.fd = open(argv[1], oflags);
+    if ((bench.fd == -1) || fstat(bench.fd, &st)) {
+        ERROR("open: %s", argv[1]);
+        return EXIT_FAILURE;
+    }
+    bench.size = st.st_size;
+
+    c = caio_create(tasks);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    bench.uring = caio_uring_create_config(c, &config);
+    if (bench.uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+#ifdef CONFIG_CAIO_DIO
+    if (direct) {
+        align = caio_dio_fdalign(bench.fd);
+        if (align == 0) {
+            ERROR("direct I/O alignment: %s", argv[1]);
+            exitstatus = EXIT_FAILURE;
+            goto terminate;
+        }
+
+        bench.dio = caio_dio_create(bench.uring, tasks, bench.blocksize,
+                align, dioflags);
+        if (bench.dio == NULL) {
+            ERROR("BLOCKSIZE must be a multiple of %zu", align);
+            exitstatus = EXIT_FAILURE;
+            goto terminate;
+        }
+    }
+#endif
+
+    readers = calloc(tasks, sizeof(struct reader));
+    if (readers == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    for (i = 0; i < tasks; i++) {
+        readers[i].bench = &bench;
+#ifdef CONFIG_CAIO_DIO
+        if (bench.dio) {
+            readers[i].bufindex = caio_dio_lease(bench.dio,
+                    &readers[i].buff);
+        }
+        else
+#endif
+        if (bench.fixed) {
+            readers[i].bufindex = caio_uring_buffer_lease(bench.uring,
+                    &readers[i].buff);
+        }
+        else {
+            readers[i].bufindex = -1;
+            readers[i].buff = malloc(bench.blocksize);
+        }
+
+        if (readers[i].buff == NULL) {
+            exitstatus = EXIT_FAILURE;
+            goto terminate;
+        }
+        reader_spawn(c, readerA, &readers[i]);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    INFO("mode: %s, tasks: %u, block: %zu, read: %lu bytes, %.1f MiB/s",
+            mode, tasks, bench.blocksize, bench.bytes,
+            bench.bytes / seconds / 1024 / 1024);
+
+terminate:
+    if (readers) {
+        for (i = 0; i < tasks; i++) {
+#ifdef CONFIG_CAIO_DIO
+            if (bench.dio) {
+                if (readers[i].buff) {
+                    caio_dio_release(bench.dio, readers[i].bufindex);
+                }
+                continue;
+            }
+#endif
+            if (bench.fixed && readers[i].buff) {
+                caio_uring_buffer_release(bench.uring, readers[i].bufindex);
+            }
+            else if (!bench.fixed) {
+                free(readers[i].buff);
+            }
+        }
+        free(readers);
+    }
+
+#ifdef CONFIG_CAIO_DIO
+    if (bench.dio) {
+        caio_dio_destroy(bench.dio);
+    }
+#endif
+
+    if (bench.uring) {
+        caio_uring_destroy(c, bench.uring);
+    }
+
+    if (c) {
+        caio_destroy(c);
+    }
+
+    close(bench.fd);
+    return exitstatus;
+}
@@ -0,0 +1,293 @@
+// Copyright 2023 Vahid Mardani
+/*
+ * This file is part of caio.
+ *  caio is free software: you can redistribute it and/or modify it under
+ *  the terms of the GNU General Public License as published by the Free
+ *  Software Foundation, either version 3 of the License, or (at your option)
+ *  any later version.
+ *
+ *  caio is distributed in the hope that it will be useful, but WITHOUT ANY
+ *  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ *  FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ *  details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with caio. If not, see <https://www.gnu.org/licenses/>.
+ *
+ *  Author: Vahid Mardani <vahid.mardani@gmail.com>
+ *
+ *
+ * io_uring(7) bulk send benchmark, a task sends MEGABYTES over a loopback
+ * TCP connection in BLOCKSIZE chunks, a thread drains the other side:
+ *
+ *   ./uring_sendbench [MODE [BLOCKSIZE [MEGABYTES]]]
+ *
+ * MODE is one of:
+ *   - copy: caio_uring_send_zc() below the threshold, a regular send.
+ *   - zc: zero-copy send, buffers return to the pool when the kernel
+ *     notifies (default).
+ *
+ * Note: the loopback device copies zero-copy sends anyway, so zc only pays
+ * off with a real NIC and large blocks.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <clog.h>
+
+#include "caio/config.h"
+#include "caio/caio.h"
+#include "caio/uring.h"
+
+
+#define PORT 3033
+#define BUFFERS 8
+
+
+typedef struct sender {
+    struct caio_uring *uring;
+    int fd;
+    size_t blocksize;
+    unsigned long remaining;
+    char *buffers[BUFFERS];
+    int free[BUFFERS];
+    int freecount;
+
+    /* current buffer and the bytes sent from it */
+    int current;
+    size_t sent;
+} sender_t;
+
+
+#undef CAIO_ARG1
+#undef CAIO_ARG2
+#undef CAIO_ENTITY
+#define CAIO_ENTITY sender
+#include "caio/generic.h"
+#include "caio/generic.c"
+
+
+static void
+_buffer_release(struct caio_uring *u, void *buf, void *ptr) {
+    struct sender *s = ptr;
+    int i;
+
+    for (i = 0; i < BUFFERS; i++) {
+        if (s->buffers[i] == buf) {
+            s->free[s->freecount++] = i;
+            return;
+        }
+    }
+}
+
+
+static ASYNC
+senderA(struct caio_task *self, struct sender *s) {
+    struct io_uring_cqe *cqe;
+    int ret;
+    CAIO_BEGIN(self);
+
+    while (s->remaining) {
+        /* wait for the kernel to give a buffer back */
+        while (s->freecount == 0) {
+            CAIO_PASS(self, CAIO_RUNNING);
+        }
+        s->current = s->free[--s->freecount];
+        s->sent = 0;
+
+        /* the first send owns the buffer, the rest are partial retries */
+        while (s->sent < s->blocksize) {
+            ret = caio_uring_send_zc(s->uring, self, s->fd,
+                    s->buffers[s->current] + s->sent,
+                    s->blocksize - s->sent, 0,
+                    s->sent? NULL: _buffer_release, s);
+            if (ret < 0) {
+                CAIO_THROW(self, ret == -1? errno: -ret);
+            }
+
+            CAIO_URING_AWAIT(s->uring, self, 1);
+            cqe = caio_uring_cqe_get(self, 0);
+            ret = cqe->res;
+            caio_uring_cqe_seen(s->uring, self, 0);
+            if (ret <= 0) {
+                CAIO_THROW(self, ret? -ret: EPIPE);
+            }
+            s->sent += ret;
+        }
+
+        s->remaining -= s->blocksize;
+    }
+
+    CAIO_FINALLY(self);
+    caio_uring_task_cleanup(s->uring, self);
+    if (self->eno) {
+        ERROR("send");
+    }
+    shutdown(s->fd, SHUT_WR);
+}
+
+
+static void *
+_drain(void *arg) {
+    int fd = *(int *)arg;
+    char buff[65536];
+
+    while (read(fd, buff, sizeof(buff)) > 0) {
+    }
+
+    return NULL;
+}
+
+
+/* A connected pair of loopback TCP sockets */
+static int
+_connect(int *server, int *client) {
+    int option = 1;
+    int listenfd;
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr = {htonl(INADDR_LOOPBACK)},
+        .sin_port = htons(PORT),
+    };
+
+    listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenfd == -1) {
+        return -1;
+    }
+
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &option, sizeof(option));
+    if (bind(listenfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+            listen(listenfd, 1)) {
+        goto failed;
+    }
+
+    *client = socket(AF_INET, SOCK_STREAM, 0);
+    if ((*client == -1) ||
+            connect(*client, (struct sockaddr *)&addr, sizeof(addr))) {
+        goto failed;
+    }
+
+    *server = accept(listenfd, NULL, NULL);
+    if (*server == -1) {
+        close(*client);
+        goto failed;
+    }
+
+    close(listenfd);
+    return 0;
+
+failed:
+    close(listenfd);
+    return -1;
+}
+
+
+int
+main(int argc, const char **argv) {
+    int exitstatus = EXIT_SUCCESS;
+    const char *mode = (argc > 1)? argv[1]: "zc";
+    size_t blocksize = (argc > 2)? atol(argv[2]): 65536;
+    unsigned long megabytes = (argc > 3)? atol(argv[3]): 1024;
+    struct caio *c = NULL;
+    struct caio_uring_stats stats;
+    struct caio_uring_config config = {
+        .jobsmax = BUFFERS * 2,
+        .sqpollcpu = -1,
+    };
+    struct sender s = {0};
+    struct timespec start;
+    struct timespec end;
+    double elapsed;
+    pthread_t drainer;
+    int client = -1;
+    int i;
+
+    if (strcmp(mode, "copy") == 0) {
+        config.zcthreshold = SIZE_MAX;
+    }
+    else if (strcmp(mode, "zc")) {
+        ERRORH("Usage: %s [copy|zc [BLOCKSIZE [MEGABYTES]]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (blocksize == 0) {
+        ERRORH("Invalid blocksize: %zu\n", blocksize);
+        return EXIT_FAILURE;
+    }
+
+    s.fd = -1;
+    s.blocksize = blocksize;
+    s.remaining = megabytes * 1024 * 1024 / blocksize * blocksize;
+    for (i = 0; i < BUFFERS; i++) {
+        s.buffers[i] = malloc(blocksize);
+        if (s.buffers[i] == NULL) {
+            exitstatus = EXIT_FAILURE;
+            goto terminate;
+        }
+        memset(s.buffers[i], 'a' + i, blocksize);
+        s.free[s.freecount++] = i;
+    }
+
+    if (_connect(&s.fd, &client)) {
+        ERROR("Cannot connect on port: %d", PORT);
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    c = caio_create(1);
+    if (c == NULL) {
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    s.uring = caio_uring_create_config(c, &config);
+    if (s.uring == NULL) {
+        ERROR("io_uring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
+    pthread_create(&drainer, NULL, _drain, &client);
+    sender_spawn(c, senderA, &s);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (caio_loop(c)) {
+        exitstatus = EXIT_FAILURE;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_join(drainer, NULL);
+
+    elapsed = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    caio_uring_stats_get(s.uring, &stats);
+    INFO("mode: %s, blocksize: %zu, seconds: %.3f, MB/s: %.0f, "
+            "zerocopy: %lu, copied: %lu", mode, blocksize, elapsed,
+            megabytes / elapsed, stats.zerocopy, stats.copied);
+
+terminate:
+    if (c) {
+        caio_uring_destroy(c, s.uring);
+        if (caio_destroy(c)) {
+            exitstatus = EXIT_FAILURE;
+        }
+    }
+    if (s.fd != -1) {
+        close(s.fd);
+    }
+    if (client != -1) {
+        close(client);
+    }
+    for (i = 0; i < BUFFERS; i++) {
+        free(s.buffers[i]);
+    }
+    return exitstatus;
+}
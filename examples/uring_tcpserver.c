@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <unistd.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 
@@ -35,6 +36,8 @@
 
 #define MAXCONN 8
 #define BUFFSIZE 1024
+#define BUFFERS 16
+#define BUFFGROUP 0
 
 
 static struct caio *_caio;
@@ -44,6 +47,9 @@ static struct caio *_caio;
 typedef struct tcpserver {
     volatile int sessions;
     struct caio_uring *uring;
+
+    /* shared by all connections, instead of a buffer per connection */
+    struct caio_uring_bufring *bufring;
 } tcpserver_t;
 
 
@@ -52,9 +58,21 @@ typedef struct tcpconn {
     int fd;
     struct sockaddr_in localaddr;
     struct sockaddr_in remoteaddr;
-    char buff[BUFFSIZE];
-    size_t bufflen;
     struct tcpserver *server;
+
+    /* received buffers, echoed in order, each one is held until it is
+     * written back entirely */
+    int bids[BUFFERS];
+    int lengths[BUFFERS];
+    unsigned int head;
+    unsigned int count;
+    int written;
+
+    bool receiving;
+    bool writing;
+    bool starved;
+    bool eof;
+    int eno;
 } tcpconn_t;
 
 
@@ -92,72 +110,131 @@ _conn_print(const struct tcpconn *c) {
 }
 
 
+/* Queues the buffer of a recv completion, or notes why the multishot recv
+ * is not armed anymore */
+static void
+_recv_complete(struct tcpconn *conn, struct io_uring_cqe *cqe) {
+    unsigned int tail;
+
+    conn->receiving = CAIO_URING_CQE_HASMORE(cqe);
+    if (CAIO_URING_CQE_HASBUFFER(cqe)) {
+        tail = (conn->head + conn->count++) % BUFFERS;
+        conn->bids[tail] = CAIO_URING_CQE_BUFFER(cqe);
+        conn->lengths[tail] = cqe->res;
+    }
+    else if (cqe->res == 0) {
+        conn->eof = true;
+    }
+    else if (cqe->res == -ENOBUFS) {
+        /* The ring was empty, armed again when a buffer is back */
+        conn->starved = true;
+    }
+    else if (cqe->res < 0) {
+        conn->eno = -cqe->res;
+    }
+}
+
+
+/* Gives the buffer back to the kernel once it is written entirely, a short
+ * write leaves the rest for the next one */
+static void
+_write_complete(struct tcpconn *conn, struct io_uring_cqe *cqe) {
+    conn->writing = false;
+    if (cqe->res < 0) {
+        conn->eno = -cqe->res;
+        return;
+    }
+
+    conn->written += cqe->res;
+    if (conn->written < conn->lengths[conn->head]) {
+        return;
+    }
+
+    caio_uring_bufring_release(conn->server->bufring,
+            conn->bids[conn->head]);
+    conn->head = (conn->head + 1) % BUFFERS;
+    conn->count--;
+    conn->written = 0;
+    conn->starved = false;
+}
+
+
 static ASYNC
 echoA(struct caio_task *self, struct tcpconn *conn) {
-    ssize_t bytes;
     int ret;
+    int i;
+    char *buff;
+    struct io_uring_cqe *cqe;
     struct tcpserver *server = conn->server;
     CAIO_BEGIN(self);
 
     while (true) {
-        /* create, setup and submit a sqe for read from socket into buffer */
-        ret = caio_uring_read(
-                server->uring,
-                self,
-                conn->fd,
-                conn->buff,
-                BUFFSIZE,
-                0);
-        if (ret < 0) {
-            ERROR("io_uring read submit.");
-            CAIO_THROW(self, -ret);
+        /* create, setup and submit a multishot recv, buffers are picked from
+         * the server's ring only when data arrives. A connection holding
+         * buffers waits for one of them to come back when the ring was
+         * empty. */
+        if (!conn->receiving && !conn->eof &&
+                !(conn->starved && conn->count)) {
+            ret = caio_uring_recv_multishot(server->uring, self, conn->fd,
+                    server->bufring, 0);
+            if (ret < 0) {
+                ERROR("io_uring recv submit.");
+                CAIO_THROW(self, -ret);
+            }
+            conn->receiving = true;
+            conn->starved = false;
         }
 
-        /* wait for task to complete */
-        CAIO_URING_AWAIT(server->uring, self, 1);
-        bytes = caio_uring_cqe_get(self, 0)->res;
-        caio_uring_cqe_seen(server->uring, self, 0);
-
-        if (bytes < 0) {
-            ERROR("read(fd: %d)", conn->fd);
-            CAIO_THROW(self, -bytes);
+        /* echo through the ring, the socket may not take it all at once */
+        if (!conn->writing && conn->count) {
+            buff = caio_uring_bufring_get(server->bufring,
+                    conn->bids[conn->head]);
+            ret = caio_uring_write(server->uring, self, conn->fd,
+                    buff + conn->written,
+                    conn->lengths[conn->head] - conn->written, 0);
+            if (ret < 0) {
+                ERROR("io_uring write submit.");
+                CAIO_THROW(self, -ret);
+            }
+            conn->writing = true;
         }
-        else if (bytes == 0) {
-            INFO("read(fd: %d) EOF", conn->fd);
-            CAIO_THROW(self, -bytes);
-        }
-        conn->bufflen = bytes;
-
-        /* tcp write */
-        ret = caio_uring_write(
-                server->uring,
-                self,
-                conn->fd,
-                conn->buff,
-                conn->bufflen,
-                0);
-        if (ret < 0) {
-            ERROR("io_uring write submit.");
-            CAIO_THROW(self, -ret);
+
+        /* EOF and everything is echoed */
+        if (!conn->receiving && !conn->writing) {
+            break;
         }
 
-        /* wait for task to complete */
+        /* wait for data or for the write */
         CAIO_URING_AWAIT(server->uring, self, 1);
-        bytes = caio_uring_cqe_get(self, 0)->res;
-        caio_uring_cqe_seen(server->uring, self, 0);
 
-        if (bytes < 0) {
-            ERROR("write(fd: %d)", conn->fd);
-            CAIO_THROW(self, -bytes);
+        for (i = 0; (cqe = caio_uring_cqe_get(self, i)); i++) {
+            if (CAIO_URING_CQE_ISMULTISHOT(cqe)) {
+                _recv_complete(conn, cqe);
+            }
+            else {
+                _write_complete(conn, cqe);
+            }
+            caio_uring_cqe_seen(server->uring, self, i);
         }
-        else if (bytes == 0) {
-            INFO("write(fd: %d) EOF", conn->fd);
-            CAIO_THROW(self, -bytes);
+
+        if (conn->eno) {
+            ERROR("echo(fd: %d)", conn->fd);
+            CAIO_THROW(self, conn->eno);
         }
     }
 
+    INFO("recv(fd: %d) EOF", conn->fd);
+
     CAIO_FINALLY(self);
     caio_uring_task_cleanup(server->uring, self);
+
+    /* The ones not echoed */
+    while (conn->count) {
+        caio_uring_bufring_release(server->bufring, conn->bids[conn->head]);
+        conn->head = (conn->head + 1) % BUFFERS;
+        conn->count--;
+    }
+
     if (conn->fd != -1) {
         close(conn->fd);
         conn->server->sessions--;
@@ -171,8 +248,9 @@ static ASYNC
 listenA(struct caio_task *self, struct tcpserver *state,
         struct sockaddr_in bindaddr, int backlog) {
     static socklen_t addrlen = sizeof(struct sockaddr_in);
-    static struct sockaddr_in connaddr;
+    struct io_uring_cqe *cqe;
     int connfd;
+    int i;
     int ret;
     static int sockopt = 1;
     static int listenfd;
@@ -220,46 +298,51 @@ listenA(struct caio_task *self, struct tcpserver *state,
         CAIO_THROW(self, errno);
     }
 
-    while (true) {
-        ret = caio_uring_accept(
-                state->uring,
-                self,
-                listenfd,
-                (struct sockaddr *)&connaddr,
-                &addrlen,
-                SOCK_NONBLOCK);
-        if (ret < 0) {
-            ERROR("io_uring accept submit.");
-            CAIO_THROW(self, -ret);
-        }
+    /* a single submission, one CQE per new connection */
+    ret = caio_uring_accept_multishot(
+            state->uring,
+            self,
+            listenfd,
+            NULL,
+            NULL,
+            SOCK_NONBLOCK);
+    if (ret < 0) {
+        ERROR("io_uring accept submit.");
+        CAIO_THROW(self, -ret);
+    }
 
-        /* wait for new connection */
+    while (true) {
+        /* wait for new connection(s) */
         CAIO_URING_AWAIT(state->uring, self, 1);
-        connfd = caio_uring_cqe_get(self, 0)->res;
-        caio_uring_cqe_seen(state->uring, self, 0);
-        if (connfd < 0) {
-            ERROR("accept");
-            CAIO_THROW(self, -connfd);
-        }
-
-        /* New Connection */
-        struct tcpconn *c = malloc(sizeof(struct tcpconn));
-        if (c == NULL) {
-            ERROR("Out of memory\n");
-            CAIO_THROW(self, errno);
-        }
 
-        c->fd = connfd;
-        c->localaddr = bindaddr;
-        c->remoteaddr = connaddr;
-        c->server = state;
-        state->sessions++;
-        _conn_print(c);
-        _state_print(state);
-        if (tcpconn_spawn(_caio, echoA, c)) {
-            ERROR("Maximum connection exceeded, fd: %d\n", connfd);
-            close(connfd);
-            free(c);
+        for (i = 0; (cqe = caio_uring_cqe_get(self, i)); i++) {
+            connfd = cqe->res;
+            caio_uring_cqe_seen(state->uring, self, i);
+            if (connfd < 0) {
+                ERROR("accept");
+                CAIO_THROW(self, -connfd);
+            }
+
+            /* New Connection */
+            struct tcpconn *c = calloc(1, sizeof(struct tcpconn));
+            if (c == NULL) {
+                ERROR("Out of memory\n");
+                close(connfd);
+                CAIO_THROW(self, errno);
+            }
+
+            c->fd = connfd;
+            c->localaddr = bindaddr;
+            getpeername(connfd, (struct sockaddr *)&c->remoteaddr, &addrlen);
+            c->server = state;
+            state->sessions++;
+            _conn_print(c);
+            _state_print(state);
+            if (tcpconn_spawn(_caio, echoA, c)) {
+                ERROR("Maximum connection exceeded, fd: %d\n", connfd);
+                close(connfd);
+                free(c);
+            }
         }
     }
 
@@ -291,14 +374,22 @@ main() {
     }
 
     /* Initialize io_uring */
-    // TODO: tune max uring tasks
-    state.uring = caio_uring_create(_caio, MAXCONN + 1, NULL);
+    /* a recv and a write per connection, the accept */
+    state.uring = caio_uring_create(_caio, MAXCONN * 2 + 1, NULL);
     if (state.uring == NULL) {
         ERROR("io_uring setup failed!");
         exitstatus = EXIT_FAILURE;
         goto terminate;
     }
 
+    state.bufring = caio_uring_bufring_create(state.uring, BUFFGROUP, BUFFERS,
+            BUFFSIZE);
+    if (state.bufring == NULL) {
+        ERROR("io_uring buffer ring setup failed!");
+        exitstatus = EXIT_FAILURE;
+        goto terminate;
+    }
+
     /* let's catch some signals */
     sigset_t signals;
     sigemptyset(&signals);
@@ -319,6 +410,9 @@ main() {
 
 terminate:
     caio_signal_destroy(_caio, sig);
+    if (state.bufring) {
+        caio_uring_bufring_destroy(state.bufring);
+    }
     caio_uring_destroy(_caio, state.uring);
 
     if (caio_destroy(_caio)) {